@@ -26,14 +26,39 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <glob.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/xattr.h>
+#endif // __linux__
 #else
 #error "Not implemented."
 #endif // _WIN32
 
 #include <cctype>
+#include <cstdlib>
 #include <cstring>
+#include <chrono>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <utility>
 #include "Common.h"
+#include "FileStreamBuffer.h"
+#include "IOThrottle.h"
+
+#include "itkMetaDataObject.h"
+
+#include "gdcmBase64.h"
+#include "gdcmGlobal.h"
+#include "gdcmDicts.h"
+#include "gdcmStringFilter.h"
+#include "gdcmSequenceOfFragments.h"
+#include "gdcmSequenceOfItems.h"
+#include "gdcmItem.h"
 
 void Trim(std::string &strString) {
   size_t p = strString.find_first_not_of(" \t\r\n");
@@ -71,6 +96,432 @@ std::vector<std::string> SplitString(const std::string &strValue, const std::str
   return vTokens;
 }
 
+uint64_t HashString(const std::string &strValue) {
+  return HashBytes(strValue.data(), strValue.size());
+}
+
+uint64_t HashBytes(const void *p_vData, size_t szSize, uint64_t ui64Hash) {
+  const unsigned char * const p_ucData = (const unsigned char *)p_vData;
+
+  for (size_t i = 0; i < szSize; ++i) {
+    ui64Hash ^= (uint64_t)p_ucData[i];
+    ui64Hash *= UINT64_C(1099511628211);
+  }
+
+  return ui64Hash;
+}
+
+bool IsHexDigit(char c) {
+  if (std::isdigit((unsigned char)c))
+    return true;
+
+  switch (std::tolower((unsigned char)c)) {
+  case 'a':
+  case 'b':
+  case 'c':
+  case 'd':
+  case 'e':
+  case 'f':
+    return true;
+  }
+
+  return false;
+}
+
+bool ParseITKTag(const std::string &strKey, uint16_t &ui16Group, uint16_t &ui16Element) {
+  if (strKey.empty() || !IsHexDigit(strKey[0]))
+    return false;
+
+  ui16Group = ui16Element = 0;
+
+  char *p = nullptr;
+  unsigned long ulTmp = strtoul(strKey.c_str(), &p, 16);
+
+  if (*p != '|' || ulTmp > std::numeric_limits<uint16_t>::max())
+    return false;
+
+  ui16Group = (uint16_t)ulTmp;
+
+  // strtoul() would also take leading spaces and signs
+  if (!IsHexDigit(*(p+1)))
+    return false;
+
+  ulTmp = strtoul(p+1, &p, 16);
+
+  // Nothing may follow, not even after an embedded '\0'
+  if (p != strKey.c_str() + strKey.size() || ulTmp > std::numeric_limits<uint16_t>::max())
+    return false;
+
+  ui16Element = (uint16_t)ulTmp;
+
+  return true;
+}
+
+namespace {
+
+// Largest b-value (s/mm^2) any parser accepts. Diffusion protocols stay well below; larger values are encoding mistakes.
+const double g_dMaxBValue = 10000.0;
+
+// Binary private elements come out of ITK base64-encoded
+bool DecodeBase64Element(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, std::vector<char> &vBuffer) {
+  std::string strValue;
+
+  vBuffer.clear();
+
+  if (!itk::ExposeMetaData<std::string>(clDicomTags, strKey, strValue))
+    return false;
+
+  const int iDecodeLength = gdcm::Base64::GetDecodeLength(strValue.c_str(), (int)strValue.size());
+
+  if (iDecodeLength <= 0)
+    return false;
+
+  vBuffer.resize(iDecodeLength);
+
+  const size_t szDecoded = gdcm::Base64::Decode(&vBuffer[0], vBuffer.size(), strValue.c_str(), strValue.size());
+
+  if (szDecoded == 0 || szDecoded > vBuffer.size())
+    return false;
+
+  vBuffer.resize(szDecoded);
+
+  return true;
+}
+
+} // end anonymous namespace
+
+template<>
+bool ExposeCSAMetaData<std::string>(gdcm::CSAHeader &clHeader, const char *p_cKey, std::string &strValue) {
+  if (!clHeader.FindCSAElementByName(p_cKey))
+    return false;
+
+  const gdcm::CSAElement &clElement = clHeader.GetCSAElementByName(p_cKey);
+  const gdcm::ByteValue * const p_clByteValue = clElement.GetByteValue();
+
+  if (p_clByteValue == nullptr)
+    return false;
+
+  strValue.clear();
+
+  if (p_clByteValue->GetLength() == 0) // Present, but empty
+    return true;
+
+  std::vector<char> vBuffer(p_clByteValue->GetLength());
+  if (!p_clByteValue->GetBuffer(&vBuffer[0], vBuffer.size()))
+    return false;
+
+  strValue.assign(vBuffer.begin(), vBuffer.end());
+
+  // CSA strings are padded with '\0' and spaces
+  strValue.erase(strValue.find_last_not_of(std::string(" \0", 2)) + 1);
+
+  return true;
+}
+
+bool GetCSAHeaderFromElement(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, gdcm::CSAHeader &clCSAHeader) {
+  uint16_t ui16Group = 0, ui16Element = 0;
+
+  clCSAHeader = gdcm::CSAHeader();
+
+  std::vector<char> vBuffer;
+
+  if (!ParseITKTag(strKey, ui16Group, ui16Element) || !DecodeBase64Element(clDicomTags, strKey, vBuffer))
+    return false;
+
+  gdcm::DataElement clDataElement;
+  clDataElement.SetTag(gdcm::Tag(ui16Group, ui16Element));
+  clDataElement.SetByteValue(&vBuffer[0], (uint32_t)vBuffer.size());
+
+  return clCSAHeader.LoadFromDataElement(clDataElement);
+}
+
+bool FindCSAElementBytes(const char *p_cData, size_t szSize, const char *p_cName, std::string &strBytes) {
+  const size_t szTagSize = 64 + 4 + 4 + 4 + 4 + 4; // Name, VM, VR, SyngoDT, number of items, 77
+  const size_t szItemSize = 4*4; // Lengths and 77 before each item's data
+
+  auto GetUInt32 = [p_cData](size_t p) -> uint32_t {
+    const unsigned char * const p_ucBytes = (const unsigned char *)p_cData + p;
+    return (uint32_t)p_ucBytes[0] | ((uint32_t)p_ucBytes[1] << 8) | ((uint32_t)p_ucBytes[2] << 16) | ((uint32_t)p_ucBytes[3] << 24);
+  };
+
+  strBytes.clear();
+
+  if (p_cData == nullptr || szSize < 16 || std::memcmp(p_cData, "SV10\4\3\2\1", 8) != 0)
+    return false;
+
+  const uint32_t ui32NumTags = GetUInt32(8);
+  const size_t szNameLength = strlen(p_cName);
+
+  if (szNameLength >= 64)
+    return false;
+
+  size_t p = 16;
+
+  for (uint32_t i = 0; i < ui32NumTags; ++i) {
+    if (szSize - p < szTagSize)
+      return false;
+
+    const size_t szBegin = p;
+    const uint32_t ui32NumItems = GetUInt32(p + 76);
+
+    p += szTagSize;
+
+    // Each item takes at least szItemSize bytes, so this bounds bogus counts too
+    if (ui32NumItems > (szSize - p) / szItemSize)
+      return false;
+
+    for (uint32_t j = 0; j < ui32NumItems; ++j) {
+      if (szSize - p < szItemSize)
+        return false;
+
+      const size_t szLength = GetUInt32(p + 4);
+
+      p += szItemSize;
+
+      if (szLength > szSize - p)
+        return false;
+
+      p += std::min((szLength + 3) & ~(size_t)3, szSize - p); // The last item may lack its padding
+    }
+
+    if (std::memcmp(p_cData + szBegin, p_cName, szNameLength) == 0 && p_cData[szBegin + szNameLength] == '\0') {
+      strBytes.assign(p_cData + szBegin, p - szBegin);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool FindCSAElementBytes(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, const char *p_cName, std::string &strBytes) {
+  std::vector<char> vBuffer;
+
+  strBytes.clear();
+
+  return DecodeBase64Element(clDicomTags, strKey, vBuffer) && FindCSAElementBytes(&vBuffer[0], vBuffer.size(), p_cName, strBytes);
+}
+
+bool GetCSAElementString(const std::string &strBytes, std::string &strValue) {
+  const size_t szTagSize = 64 + 4 + 4 + 4 + 4 + 4;
+  const size_t szItemSize = 4*4;
+
+  auto GetUInt32 = [&strBytes](size_t p) -> uint32_t {
+    const unsigned char * const p_ucBytes = (const unsigned char *)strBytes.data() + p;
+    return (uint32_t)p_ucBytes[0] | ((uint32_t)p_ucBytes[1] << 8) | ((uint32_t)p_ucBytes[2] << 16) | ((uint32_t)p_ucBytes[3] << 24);
+  };
+
+  strValue.clear();
+
+  if (strBytes.size() < szTagSize)
+    return false;
+
+  const uint32_t ui32NumItems = GetUInt32(76);
+
+  size_t p = szTagSize;
+
+  for (uint32_t i = 0; i < ui32NumItems; ++i) {
+    if (strBytes.size() - p < szItemSize)
+      return false;
+
+    const size_t szLength = GetUInt32(p + 4);
+
+    p += szItemSize;
+
+    if (szLength > strBytes.size() - p)
+      return false;
+
+    if (szLength > 0) {
+      if (i > 0)
+        strValue += '\\';
+
+      // Same as gdcm: an item ends at its first '\0'
+      strValue.append(strBytes.data() + p, strnlen(strBytes.data() + p, szLength));
+    }
+
+    p += std::min((szLength + 3) & ~(size_t)3, strBytes.size() - p);
+  }
+
+  // CSA strings are padded with '\0' and spaces
+  strValue.erase(strValue.find_last_not_of(std::string(" \0", 2)) + 1);
+
+  return true;
+}
+
+bool ParseGEBValue(const std::string &strValue_, std::string &strBValue) {
+  std::string strValue = strValue_;
+
+  size_t p = strValue.find('\\');
+  if (p != std::string::npos)
+    strValue.erase(p);
+
+  std::stringstream valueStream;
+  valueStream.str(strValue);
+
+  double dValue = 0.0;
+
+  if (!(valueStream >> dValue) || dValue < 0.0) // Bogus value
+    return false;
+
+  // Something is screwed up here ... let's try to remove the largest significant digit
+  if (dValue > g_dMaxBValue) {
+    p = strValue.find_first_not_of(" \t0");
+
+    strValue.erase(strValue.begin(), strValue.begin()+p+1);
+
+    valueStream.clear();
+    valueStream.str(strValue);
+
+    if (!(valueStream >> dValue) || dValue < 0.0 || dValue > g_dMaxBValue)
+      return false;
+  }
+
+  return NormalizeBValue(std::to_string((long long)dValue), strBValue);
+}
+
+bool ParseSequenceNameBValue(const std::string &strSequenceName, std::string &strBValue) {
+  std::stringstream valueStream;
+
+  unsigned int uiBValue = 0;
+
+  size_t i = 0, j = 0;
+  while (i < strSequenceName.size()) {
+    i = strSequenceName.find('b', i); 
+
+    if (i == std::string::npos || ++i >= strSequenceName.size())
+      break;
+
+    j = strSequenceName.find_first_not_of("0123456789", i); 
+
+    // Should end with a 't' (trace), a '#' (direction) or a '\0'
+    if (j == std::string::npos)
+      j = strSequenceName.size();
+    else if (strSequenceName[j] != 't' && strSequenceName[j] != '#')
+      continue; // Maybe a later 'b'
+
+    if (j > i) {
+      strBValue = strSequenceName.substr(i, j-i);
+      valueStream.clear();
+      valueStream.str(strBValue);
+
+      uiBValue = 0;
+
+      if (valueStream >> uiBValue && uiBValue <= g_dMaxBValue) // Otherwise bogus, keep looking
+        return true;
+    }   
+
+    i = j;
+  }
+
+  strBValue.clear();
+
+  return false;
+}
+
+bool NormalizeBValue(const std::string &strValue, std::string &strBValue) {
+  std::string strTmp = strValue;
+  Trim(strTmp);
+
+  if (strTmp.empty())
+    return false;
+
+  char *p = nullptr;
+  const double dValue = strtod(strTmp.c_str(), &p);
+
+  if (*p != '\0' || !std::isfinite(dValue) || dValue < 0.0 || dValue > g_dMaxBValue)
+    return false;
+
+  strBValue = std::to_string((long long)std::floor(dValue + 0.5));
+
+  return true;
+}
+
+bool ParsePhilipsBValue(const std::string &strValue, std::string &strBValue) {
+  if (NormalizeBValue(strValue, strBValue))
+    return true;
+
+  // Without a private dictionary (e.g. implicit VR) the FL comes through as base64
+  const int iDecodeLength = gdcm::Base64::GetDecodeLength(strValue.c_str(), (int)strValue.size());
+
+  if (iDecodeLength != (int)sizeof(float))
+    return false;
+
+  unsigned char a_ucBuffer[sizeof(float)];
+
+  if (gdcm::Base64::Decode((char *)a_ucBuffer, sizeof(a_ucBuffer), strValue.c_str(), strValue.size()) == 0)
+    return false;
+
+  const uint32_t ui32Bits = (uint32_t)a_ucBuffer[0] | ((uint32_t)a_ucBuffer[1] << 8) | ((uint32_t)a_ucBuffer[2] << 16) | ((uint32_t)a_ucBuffer[3] << 24);
+
+  float fValue = 0.0f;
+  std::memcpy(&fValue, &ui32Bits, sizeof(fValue));
+
+  return NormalizeBValue(std::to_string((double)fValue), strBValue);
+}
+
+bool FindFunctionalGroupBValue(const gdcm::DataSet &clDataSet, std::string &strBValue) {
+  const gdcm::Tag a_clGroupTags[] = { gdcm::Tag(0x5200, 0x9229), gdcm::Tag(0x5200, 0x9230) }; // Shared, then per-frame
+  const gdcm::Tag clDiffusionTag(0x0018, 0x9117);
+  const gdcm::Tag clBValueTag(0x0018, 0x9087);
+
+  bool bFound = false;
+  strBValue.clear();
+
+  for (const gdcm::Tag &clGroupTag : a_clGroupTags) {
+    if (!clDataSet.FindDataElement(clGroupTag))
+      continue;
+
+    const gdcm::SmartPointer<gdcm::SequenceOfItems> p_clGroups = clDataSet.GetDataElement(clGroupTag).GetValueAsSQ();
+
+    if (!p_clGroups)
+      continue;
+
+    for (gdcm::SequenceOfItems::SizeType i = 1; i <= p_clGroups->GetNumberOfItems(); ++i) {
+      const gdcm::DataSet &clGroup = p_clGroups->GetItem(i).GetNestedDataSet();
+
+      if (!clGroup.FindDataElement(clDiffusionTag))
+        continue;
+
+      const gdcm::SmartPointer<gdcm::SequenceOfItems> p_clDiffusion = clGroup.GetDataElement(clDiffusionTag).GetValueAsSQ();
+
+      if (!p_clDiffusion || p_clDiffusion->GetNumberOfItems() == 0 || !p_clDiffusion->GetItem(1).GetNestedDataSet().FindDataElement(clBValueTag))
+        continue;
+
+      // FD, little endian like every transfer syntax still in use
+      const gdcm::ByteValue * const p_clValue = p_clDiffusion->GetItem(1).GetNestedDataSet().GetDataElement(clBValueTag).GetByteValue();
+      std::string strValue;
+
+      if (p_clValue != nullptr && p_clValue->GetLength() == sizeof(double)) {
+        const unsigned char * const p_ucBytes = (const unsigned char *)p_clValue->GetPointer();
+
+        uint64_t ui64Bits = 0;
+        for (int j = (int)sizeof(double)-1; j >= 0; --j)
+          ui64Bits = (ui64Bits << 8) | p_ucBytes[j];
+
+        double dValue = 0.0;
+        std::memcpy(&dValue, &ui64Bits, sizeof(dValue));
+
+        if (!NormalizeBValue(std::to_string(dValue), strValue))
+          strValue.clear();
+      }
+
+      if (!bFound) {
+        bFound = true;
+        strBValue = strValue;
+      }
+      else if (strValue != strBValue) {
+        strBValue.clear();
+        return true;
+      }
+    }
+
+    // The shared group applies to every frame
+    if (bFound)
+      return true;
+  }
+
+  return bFound;
+}
+
 #ifdef _WIN32
 bool FileExists(const std::string &strPath) {
   return GetFileAttributes(strPath.c_str()) != INVALID_FILE_ATTRIBUTES;
@@ -104,6 +555,76 @@ bool IsFolder(const std::string &strPath) {
 }
 #endif // __unix__
 
+#ifdef _WIN32
+uint64_t FileSize(const std::string &strPath) {
+  WIN32_FILE_ATTRIBUTE_DATA stData;
+  memset(&stData, 0, sizeof(stData));
+
+  if (GetFileAttributesEx(strPath.c_str(), GetFileExInfoStandard, &stData) == 0)
+    return 0;
+
+  return ((uint64_t)stData.nFileSizeHigh << 32) | stData.nFileSizeLow;
+}
+#endif // _WIN32
+
+#ifdef __unix__
+uint64_t FileSize(const std::string &strPath) {
+  struct stat stBuff;
+  memset(&stBuff, 0, sizeof(stBuff));
+
+  if (stat(strPath.c_str(), &stBuff) != 0)
+    return 0;
+
+  return (uint64_t)stBuff.st_size;
+}
+#endif // __unix__
+
+#ifdef _WIN32
+bool GetFileId(const std::string &strPath, FileId &stId, unsigned int *p_uiNumLinks) {
+  // FILE_FLAG_BACKUP_SEMANTICS is needed to open folders
+  HANDLE hFile = CreateFile(strPath.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+
+  if (hFile == INVALID_HANDLE_VALUE)
+    return false;
+
+  BY_HANDLE_FILE_INFORMATION stInfo;
+  memset(&stInfo, 0, sizeof(stInfo));
+
+  const BOOL bSuccess = GetFileInformationByHandle(hFile, &stInfo);
+
+  CloseHandle(hFile);
+
+  if (bSuccess == FALSE)
+    return false;
+
+  stId.ui64Device = stInfo.dwVolumeSerialNumber;
+  stId.ui64Inode = ((uint64_t)stInfo.nFileIndexHigh << 32) | stInfo.nFileIndexLow;
+
+  if (p_uiNumLinks != nullptr)
+    *p_uiNumLinks = (unsigned int)stInfo.nNumberOfLinks;
+
+  return true;
+}
+#endif // _WIN32
+
+#ifdef __unix__
+bool GetFileId(const std::string &strPath, FileId &stId, unsigned int *p_uiNumLinks) {
+  struct stat stBuff;
+  memset(&stBuff, 0, sizeof(stBuff));
+
+  if (stat(strPath.c_str(), &stBuff) != 0)
+    return false;
+
+  stId.ui64Device = (uint64_t)stBuff.st_dev;
+  stId.ui64Inode = (uint64_t)stBuff.st_ino;
+
+  if (p_uiNumLinks != nullptr)
+    *p_uiNumLinks = (unsigned int)stBuff.st_nlink;
+
+  return true;
+}
+#endif // __unix__
+
 #ifdef _WIN32
 bool RmDir(const std::string &strPath) {
   return RemoveDirectory(strPath.c_str()) != 0;
@@ -252,28 +773,100 @@ void USleep(unsigned int uiMicroSeconds) {
 #endif // __unix__
 
 #ifdef _WIN32
-std::string BaseName(std::string strPath) {
-  if (strPath.empty())
-    return std::string();
+int64_t GetProcessAgeMilliSeconds() {
+  FILETIME stCreationTime, stExitTime, stKernelTime, stUserTime, stNow;
 
-  while (strPath.size() > 1 && (strPath.back() == '/' || strPath.back() == '\\'))
-    strPath.pop_back();
+  if (GetProcessTimes(GetCurrentProcess(), &stCreationTime, &stExitTime, &stKernelTime, &stUserTime) == FALSE)
+    return 0;
 
-  if (strPath.size() == 1)
-    return strPath;
+  GetSystemTimeAsFileTime(&stNow);
 
-  size_t p = strPath.find_last_of("/\\");
+  ULARGE_INTEGER uliCreationTime, uliNow;
 
-  return p != std::string::npos ? strPath.substr(p+1) : strPath;
+  uliCreationTime.LowPart = stCreationTime.dwLowDateTime;
+  uliCreationTime.HighPart = stCreationTime.dwHighDateTime;
+  uliNow.LowPart = stNow.dwLowDateTime;
+  uliNow.HighPart = stNow.dwHighDateTime;
+
+  // 100 ns units
+  return uliNow.QuadPart > uliCreationTime.QuadPart ? (int64_t)((uliNow.QuadPart - uliCreationTime.QuadPart) / 10000) : 0;
 }
 #endif // _WIN32
 
-#ifdef __unix__
-std::string BaseName(std::string strPath) {
-  if (strPath.empty())
-    return std::string();
+#ifdef __linux__
+int64_t GetProcessAgeMilliSeconds() {
+  std::ifstream clStatStream("/proc/self/stat");
+  std::string strLine;
 
-  while (strPath.size() > 1 && strPath.back() == '/')
+  if (!std::getline(clStatStream, strLine))
+    return 0;
+
+  // The command name (field 2) is in parentheses and may hold anything, so count from the last ')' (field 3 is the state)
+  const size_t p = strLine.rfind(')');
+
+  if (p == std::string::npos)
+    return 0;
+
+  std::stringstream clFieldStream(strLine.substr(p + 1));
+  std::string strField;
+
+  for (int i = 3; i < 22 && (clFieldStream >> strField); ++i) { }
+
+  unsigned long long ullStartTicks = 0; // Field 22, clock ticks after boot
+
+  struct timespec stNow;
+
+  if (!(clFieldStream >> ullStartTicks) || clock_gettime(CLOCK_BOOTTIME, &stNow) != 0)
+    return 0;
+
+  const long lTicksPerSecond = sysconf(_SC_CLK_TCK);
+
+  if (lTicksPerSecond <= 0)
+    return 0;
+
+  const int64_t i64Now = (int64_t)stNow.tv_sec * 1000 + stNow.tv_nsec / 1000000;
+  const int64_t i64Start = (int64_t)(ullStartTicks * 1000 / (unsigned long long)lTicksPerSecond);
+
+  return i64Now > i64Start ? i64Now - i64Start : 0;
+}
+#endif // __linux__
+
+#if defined(__unix__) && !defined(__linux__)
+namespace {
+
+// Closest to process start without OS support
+const std::chrono::steady_clock::time_point g_clStartTime = std::chrono::steady_clock::now();
+
+} // end anonymous namespace
+
+int64_t GetProcessAgeMilliSeconds() {
+  return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - g_clStartTime).count();
+}
+#endif // __unix__ && !__linux__
+
+#ifdef _WIN32
+std::string BaseName(std::string strPath) {
+  if (strPath.empty())
+    return std::string();
+
+  while (strPath.size() > 1 && (strPath.back() == '/' || strPath.back() == '\\'))
+    strPath.pop_back();
+
+  if (strPath.size() == 1)
+    return strPath;
+
+  size_t p = strPath.find_last_of("/\\");
+
+  return p != std::string::npos ? strPath.substr(p+1) : strPath;
+}
+#endif // _WIN32
+
+#ifdef __unix__
+std::string BaseName(std::string strPath) {
+  if (strPath.empty())
+    return std::string();
+
+  while (strPath.size() > 1 && strPath.back() == '/')
     strPath.pop_back();
 
   if (strPath.size() == 1)
@@ -371,6 +964,98 @@ void SanitizeFileName(std::string &strFileName) {
 }
 #endif // __unix__
 
+namespace {
+
+bool LooksLikeDicom(const unsigned char *p_ucBuffer, size_t szLength) {
+  // Part 10 file: 128 byte preamble followed by "DICM"
+  if (szLength >= 132 && std::memcmp(p_ucBuffer + 128, "DICM", 4) == 0)
+    return true;
+
+  if (szLength < 8)
+    return false;
+
+  // No preamble: the data set should start with a low group (little endian) ...
+  const uint16_t ui16Group = (uint16_t)(p_ucBuffer[0] | (p_ucBuffer[1] << 8));
+
+  if (ui16Group != 0x0002 && ui16Group != 0x0008)
+    return false;
+
+  // ... followed by either an explicit VR ...
+  static const char * const a_cVRs[] = { "AE", "AS", "AT", "CS", "DA", "DS", "DT", "FD", "FL", "IS", "LO", "LT", "OB", "OD", "OF", "OL", "OW", "PN", "SH", "SL", "SQ", "SS", "ST", "TM", "UC", "UI", "UL", "UN", "UR", "US", "UT" };
+
+  for (const char *p_cVR : a_cVRs) {
+    if (std::memcmp(p_ucBuffer + 4, p_cVR, 2) == 0)
+      return true;
+  }
+
+  // ... or an implicit VR length that is not absurd for an early group 0008 element
+  const uint32_t ui32Length = (uint32_t)p_ucBuffer[4] | ((uint32_t)p_ucBuffer[5] << 8) | ((uint32_t)p_ucBuffer[6] << 16) | ((uint32_t)p_ucBuffer[7] << 24);
+
+  return ui32Length < 0x10000;
+}
+
+} // end anonymous namespace
+
+#ifdef _WIN32
+bool IsDicomFile(const std::string &strPath) {
+  unsigned char a_ucBuffer[132];
+
+  FILE *pFile = fopen(strPath.c_str(), "rb");
+
+  if (pFile == nullptr)
+    return false;
+
+  const size_t szSizeRead = fread(a_ucBuffer, 1, sizeof(a_ucBuffer), pFile);
+
+  fclose(pFile);
+
+  return LooksLikeDicom(a_ucBuffer, szSizeRead);
+}
+#endif // _WIN32
+
+#ifdef __unix__
+bool IsDicomFile(const std::string &strPath) {
+  unsigned char a_ucBuffer[132];
+
+  const int iFd = open(strPath.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (iFd == -1)
+    return false;
+
+  const ssize_t sszSizeRead = pread(iFd, a_ucBuffer, sizeof(a_ucBuffer), 0);
+
+  close(iFd);
+
+  return sszSizeRead > 0 && LooksLikeDicom(a_ucBuffer, (size_t)sszSizeRead);
+}
+#endif // __unix__
+
+#ifdef _WIN32
+bool DropFileCache(const std::string &) {
+  return true;
+}
+#endif // _WIN32
+
+#ifdef __unix__
+bool DropFileCache(const std::string &strPath) {
+  const int iFd = open(strPath.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (iFd == -1)
+    return false;
+
+#ifdef __linux__
+  // Dirty pages (e.g. written in place) can't be dropped until they are written back
+  sync_file_range(iFd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif // __linux__
+
+  const int iRet = posix_fadvise(iFd, 0, 0, POSIX_FADV_DONTNEED);
+
+  close(iFd);
+
+  return iRet == 0;
+}
+#endif // __unix__
+
 #ifdef _WIN32
 void FindFiles(const char *p_cDir, const char *p_cPattern, std::vector<std::string> &vFiles, bool bRecursive) {
   std::string strPattern(p_cDir);
@@ -469,6 +1154,162 @@ void FindFiles(const char *p_cDir, const char *p_cPattern, std::vector<std::stri
 }
 #endif // __unix__
 
+namespace {
+
+// Symlinks (and junctions) are followed like FindFiles() does, but not back into a folder that is already being walked
+bool EnterFolder(const std::string &strDir, std::vector<FileId> &vAncestors) {
+  FileId stId;
+
+  if (!GetFileId(strDir, stId))
+    return false;
+
+  for (const FileId &stAncestor : vAncestors) {
+    if (stAncestor == stId) {
+      std::cerr << "Warning: Not following '" << strDir << "' since it leads back to a folder being searched." << std::endl;
+      return false;
+    }
+  }
+
+  vAncestors.push_back(stId);
+
+  return true;
+}
+
+#ifdef _WIN32
+bool WalkFolder(const std::string &strDir, const char *p_cPattern, const std::function<bool(const std::string &)> &clVisit, bool bRecursive, std::vector<FileId> &vAncestors) {
+  std::string strPattern(strDir);
+  strPattern += '\\';
+  strPattern += p_cPattern;
+
+  WIN32_FIND_DATA stFindData;
+
+  memset(&stFindData, 0, sizeof(stFindData));
+
+  HANDLE hFind = FindFirstFile(strPattern.c_str(), &stFindData);
+
+  if (hFind != INVALID_HANDLE_VALUE) {
+    do {
+      if (!(stFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        std::string strPath(strDir);
+        strPath += '\\';
+        strPath += stFindData.cFileName;
+
+        if (!clVisit(strPath)) {
+          FindClose(hFind);
+          return false;
+        }
+      }
+    } while (FindNextFile(hFind, &stFindData) != FALSE);
+
+    FindClose(hFind);
+  }
+
+  if (!bRecursive)
+    return true;
+
+  strPattern = strDir;
+  strPattern += "\\*";
+
+  memset(&stFindData, 0, sizeof(stFindData));
+
+  hFind = FindFirstFile(strPattern.c_str(), &stFindData);
+
+  if (hFind == INVALID_HANDLE_VALUE)
+    return true;
+
+  bool bContinue = true;
+
+  do {
+    if (strcmp(stFindData.cFileName, ".") == 0 || strcmp(stFindData.cFileName, "..") == 0)
+      continue;
+
+    if (stFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      std::string strPath(strDir);
+      strPath += '\\';
+      strPath += stFindData.cFileName;
+
+      if (EnterFolder(strPath, vAncestors)) {
+        bContinue = WalkFolder(strPath, p_cPattern, clVisit, bRecursive, vAncestors);
+        vAncestors.pop_back();
+      }
+    }
+  } while (bContinue && FindNextFile(hFind, &stFindData) != FALSE);
+
+  FindClose(hFind);
+
+  return bContinue;
+}
+#endif // _WIN32
+
+#ifdef __unix__
+bool WalkFolder(const std::string &strDir, const char *p_cPattern, const std::function<bool(const std::string &)> &clVisit, bool bRecursive, std::vector<FileId> &vAncestors) {
+  DIR *p_stDir = opendir(strDir.c_str());
+
+  if (p_stDir == nullptr)
+    return true; // Same as an empty folder for FindFiles()
+
+  bool bContinue = true;
+
+  struct dirent *p_stEntry = nullptr;
+  while (bContinue && (p_stEntry = readdir(p_stDir)) != nullptr) {
+    if (p_stEntry->d_name[0] == '.') // Hidden like glob(), also skips . and ..
+      continue;
+
+    std::string strPath = strDir;
+    strPath += '/';
+    strPath += p_stEntry->d_name;
+
+    unsigned char ucType = p_stEntry->d_type;
+
+    if (ucType == DT_UNKNOWN || ucType == DT_LNK) {
+      // Follow symlinks like glob() and IsFolder() in FindFiles()
+      struct stat stBuff;
+      memset(&stBuff, 0, sizeof(stBuff));
+
+      if (stat(strPath.c_str(), &stBuff) != 0) // Dangling symlink?
+        continue;
+
+      if (S_ISDIR(stBuff.st_mode))
+        ucType = DT_DIR;
+      else if (S_ISREG(stBuff.st_mode))
+        ucType = DT_REG;
+      else
+        continue;
+    }
+
+    switch (ucType) {
+    case DT_DIR:
+      if (bRecursive && EnterFolder(strPath, vAncestors)) {
+        bContinue = WalkFolder(strPath, p_cPattern, clVisit, bRecursive, vAncestors);
+        vAncestors.pop_back();
+      }
+      break;
+    case DT_REG:
+      if (fnmatch(p_cPattern, p_stEntry->d_name, FNM_PERIOD) == 0)
+        bContinue = clVisit(strPath);
+      break;
+    default: // Devices, sockets, etc...
+      break;
+    }
+  }
+
+  closedir(p_stDir);
+
+  return bContinue;
+}
+#endif // __unix__
+
+} // end anonymous namespace
+
+bool WalkFiles(const char *p_cDir, const char *p_cPattern, const std::function<bool(const std::string &)> &clVisit, bool bRecursive) {
+  std::vector<FileId> vAncestors;
+
+  if (bRecursive && !EnterFolder(p_cDir, vAncestors))
+    return true; // Same as an empty folder for FindFiles()
+
+  return WalkFolder(p_cDir, p_cPattern, clVisit, bRecursive, vAncestors);
+}
+
 #ifdef _WIN32
 void FindFolders(const char *p_cDir, const char *p_cPattern, std::vector<std::string> &vFolders, bool bRecursive) {
   std::string strPattern(p_cDir);
@@ -518,7 +1359,7 @@ void FindFolders(const char *p_cDir, const char *p_cPattern, std::vector<std::st
         strPath += '\\';
         strPath += stFindData.cFileName;
 
-        FindFiles(strPath.c_str(), p_cPattern, vFolders, bRecursive);
+        FindFolders(strPath.c_str(), p_cPattern, vFolders, bRecursive);
       }
     } while (FindNextFile(hFind, &stFindData) != FALSE);
 
@@ -571,32 +1412,727 @@ void FindFolders(const char *p_cDir, const char *p_cPattern, std::vector<std::st
 
 #endif // __unix__
 
-void FindDicomFolders(const char *p_cDir, const char *p_cPattern, std::vector<std::string> &vFolders, bool bRecursive) {
-  typedef itk::GDCMImageIO ImageIOType;
+namespace {
+
+bool GetDicomString(const gdcm::StringFilter &clFilter, const gdcm::DataSet &clDataSet, const gdcm::Tag &clTag, std::string &strValue) {
+  strValue.clear();
+
+  if (!clDataSet.FindDataElement(clTag))
+    return false;
+
+  strValue = clFilter.ToString(clTag);
+  Trim(strValue);
+
+  return strValue.size() > 0;
+}
+
+bool GetDicomNumber(const gdcm::StringFilter &clFilter, const gdcm::DataSet &clDataSet, const gdcm::Tag &clTag, double &dValue) {
+  std::string strValue;
+
+  if (!GetDicomString(clFilter, clDataSet, clTag, strValue))
+    return false;
+
+  char *p = nullptr;
+  dValue = strtod(strValue.c_str(), &p);
+
+  return *p == '\0';
+}
+
+void ReplaceDicomElement(gdcm::DataSet &clDataSet, const gdcm::Tag &clTag, const gdcm::VR &clVR, std::string strValue) {
+  if (strValue.size() % 2 != 0)
+    strValue.push_back(clVR == gdcm::VR::UI ? '\0' : ' ');
 
-  ImageIOType::Pointer p_clImageIO = ImageIOType::New();
+  gdcm::DataElement clElement(clTag);
+  clElement.SetVR(clVR);
+  clElement.SetByteValue(strValue.data(), (uint32_t)strValue.size());
 
-  std::vector<std::string> vTmpFolders, vTmpFiles;
+  clDataSet.Replace(clElement);
+}
+
+} // end anonymous namespace
+
+bool GetDicomPixelFormat(const gdcm::File &clFile, DicomPixelFormat &stFormat) {
+  const gdcm::DataSet &clDataSet = clFile.GetDataSet();
+
+  gdcm::StringFilter clFilter;
+  clFilter.SetFile(clFile);
+
+  double dRows = 0.0, dColumns = 0.0, dSamplesPerPixel = 1.0, dBitsAllocated = 0.0, dPixelRepresentation = 0.0, dNumberOfFrames = 1.0;
+
+  if (!GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x0010), dRows) || !GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x0011), dColumns) ||
+    !GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x0100), dBitsAllocated)) {
+    std::cerr << "Error: Could not determine image dimensions or bits allocated." << std::endl;
+    return false;
+  }
 
-  vTmpFolders.push_back(p_cDir); // Check base folder too
+  GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x0002), dSamplesPerPixel);
+  GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x0103), dPixelRepresentation);
+  GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x0008), dNumberOfFrames);
 
-  FindFolders(p_cDir, p_cPattern, vTmpFolders, bRecursive);
+  if (dNumberOfFrames != 1.0) {
+    std::cerr << "Error: Multi-frame images are not supported." << std::endl;
+    return false;
+  }
+
+  if (dBitsAllocated != 8.0 && dBitsAllocated != 16.0 && dBitsAllocated != 32.0) {
+    std::cerr << "Error: Unsupported bits allocated (" << dBitsAllocated << ")." << std::endl;
+    return false;
+  }
+
+  stFormat.uiRows = (unsigned int)dRows;
+  stFormat.uiColumns = (unsigned int)dColumns;
+  stFormat.uiSamplesPerPixel = (unsigned int)dSamplesPerPixel;
+  stFormat.uiBitsAllocated = (unsigned int)dBitsAllocated;
+  stFormat.bSigned = (dPixelRepresentation != 0.0);
+  stFormat.dRescaleSlope = 1.0;
+  stFormat.dRescaleIntercept = 0.0;
 
-  for (size_t i = 0; i < vTmpFolders.size(); ++i) {
-    const std::string &strFolder = vTmpFolders[i];
+  if (!GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x1053), stFormat.dRescaleSlope) || stFormat.dRescaleSlope == 0.0)
+    stFormat.dRescaleSlope = 1.0;
 
-    vTmpFiles.clear();
+  GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0028, 0x1052), stFormat.dRescaleIntercept);
+
+  return true;
+}
 
-    FindFiles(strFolder.c_str(), "*", vTmpFiles, false);
+bool SetDicomPixelData(gdcm::File &clFile, const DicomPixelFormat &stFormat, const std::vector<char> &vPixelData) {
+  gdcm::FileMetaInformation &clHeader = clFile.GetHeader();
+  gdcm::DataSet &clDataSet = clFile.GetDataSet();
+
+  const gdcm::TransferSyntax clTransferSyntax = clHeader.GetDataSetTransferSyntax();
+
+  if (clTransferSyntax == gdcm::TransferSyntax::ExplicitVRBigEndian || clTransferSyntax == gdcm::TransferSyntax::ImplicitVRBigEndianPrivateGE) {
+    std::cerr << "Error: Big endian transfer syntaxes are not supported." << std::endl;
+    return false;
+  }
+
+  if (vPixelData.empty())
+    return false;
+
+  gdcm::DataElement clPixelData(gdcm::Tag(0x7fe0, 0x0010));
+  clPixelData.SetVR(stFormat.uiBitsAllocated > 8 ? gdcm::VR::OW : gdcm::VR::OB);
+  clPixelData.SetByteValue(&vPixelData[0], (uint32_t)vPixelData.size());
+
+  clDataSet.Replace(clPixelData);
+
+  if (clTransferSyntax.IsEncapsulated() || clTransferSyntax == gdcm::TransferSyntax::DeflatedExplicitVRLittleEndian) {
+    // Samples are now uncompressed and interleaved
+    clHeader.SetDataSetTransferSyntax(gdcm::TransferSyntax::ExplicitVRLittleEndian);
+    ReplaceDicomElement(clHeader, gdcm::Tag(0x0002, 0x0010), gdcm::VR::UI, gdcm::TransferSyntax::GetTSString(gdcm::TransferSyntax::ExplicitVRLittleEndian));
+
+    if (stFormat.uiSamplesPerPixel == 3) {
+      const uint16_t ui16PlanarConfiguration = 0;
+
+      ReplaceDicomElement(clDataSet, gdcm::Tag(0x0028, 0x0004), gdcm::VR::CS, "RGB");
+      ReplaceDicomElement(clDataSet, gdcm::Tag(0x0028, 0x0006), gdcm::VR::US, std::string((const char *)&ui16PlanarConfiguration, sizeof(ui16PlanarConfiguration)));
+    }
+  }
+
+  return true;
+}
 
-    for (size_t j = 0; j < vTmpFiles.size(); ++j) {
-      const std::string &strFile = vTmpFiles[j];
+bool AddMissingDicomTags(gdcm::File &clFile, const itk::MetaDataDictionary &clDicomTags) {
+  typedef itk::MetaDataObject<std::string> StringObjectType;
 
-      if (p_clImageIO->CanReadFile(strFile.c_str())) {
-        vFolders.push_back(strFolder);
-        break;
+  const gdcm::Dicts &clDicts = gdcm::Global::GetInstance().GetDicts();
+  gdcm::DataSet &clDataSet = clFile.GetDataSet();
+
+  gdcm::StringFilter clFilter;
+  clFilter.SetFile(clFile);
+
+  for (auto itr = clDicomTags.Begin(); itr != clDicomTags.End(); ++itr) {
+    uint16_t ui16Group = 0, ui16Element = 0;
+
+    if (!ParseITKTag(itr->first, ui16Group, ui16Element))
+      continue; // Something like ITK_original_direction
+
+    const gdcm::Tag clTag(ui16Group, ui16Element);
+
+    // File meta information is managed by the writer and private tags need their creator
+    if (ui16Group == 0x0002 || clTag.IsPrivate() || clDataSet.FindDataElement(clTag))
+      continue;
+
+    const StringObjectType * const p_clObject = dynamic_cast<const StringObjectType *>(itr->second.GetPointer());
+
+    if (p_clObject == nullptr)
+      continue;
+
+    const std::string &strValue = p_clObject->GetMetaDataObjectValue();
+    const gdcm::VR clVR = clDicts.GetDictEntry(clTag).GetVR();
+
+    std::string strRawValue;
+
+    switch (clVR) {
+    case gdcm::VR::OB:
+    case gdcm::VR::OW:
+    case gdcm::VR::OF:
+    case gdcm::VR::UN:
+      {
+        // ITK stores these base64 encoded
+        const int iDecodeLength = gdcm::Base64::GetDecodeLength(strValue.c_str(), (int)strValue.size());
+
+        if (iDecodeLength <= 0)
+          continue;
+
+        strRawValue.resize(iDecodeLength);
+
+        if (gdcm::Base64::Decode(&strRawValue[0], strRawValue.size(), strValue.c_str(), strValue.size()) == 0)
+          continue;
       }
+      break;
+    case gdcm::VR::INVALID:
+    case gdcm::VR::SQ:
+    case gdcm::VR::OB_OW:
+    case gdcm::VR::US_SS:
+    case gdcm::VR::US_SS_OW:
+      std::cerr << "Warning: Not adding tag '" << itr->first << "' with unknown or ambiguous VR." << std::endl;
+      continue;
+    default:
+      strRawValue = clFilter.FromString(clTag, strValue.c_str(), strValue.size());
+      break;
+    }
+
+    ReplaceDicomElement(clDataSet, clTag, clVR, strRawValue);
+  }
+
+  return true;
+}
+
+namespace {
+
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const unsigned char *) { return itk::ImageIOBase::UCHAR; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const char *) { return itk::ImageIOBase::CHAR; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const unsigned short *) { return itk::ImageIOBase::USHORT; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const short *) { return itk::ImageIOBase::SHORT; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const unsigned int *) { return itk::ImageIOBase::UINT; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const int *) { return itk::ImageIOBase::INT; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const float *) { return itk::ImageIOBase::FLOAT; }
+constexpr itk::ImageIOBase::IOComponentType GetComponentType(const double *) { return itk::ImageIOBase::DOUBLE; }
+
+// Calls clFunctor.Apply<ComponentType>() for the listed type matching eComponentType
+template<typename FunctorType>
+bool DispatchComponentType(itk::ImageIOBase::IOComponentType, FunctorType &, TypeList<>) {
+  return false;
+}
+
+template<typename FunctorType, typename ComponentType, typename... ComponentTypes>
+bool DispatchComponentType(itk::ImageIOBase::IOComponentType eComponentType, FunctorType &clFunctor, TypeList<ComponentType, ComponentTypes...>) {
+  if (eComponentType == GetComponentType((const ComponentType *)nullptr)) {
+    clFunctor.template Apply<ComponentType>();
+    return true;
+  }
+
+  return DispatchComponentType(eComponentType, clFunctor, TypeList<ComponentTypes...>());
+}
+
+struct NullFunctor {
+  template<typename ComponentType>
+  void Apply() { }
+};
+
+struct EncodeFunctor {
+  const void * const p_vBuffer;
+  const size_t szCount;
+  const DicomPixelFormat &stFormat;
+  std::vector<char> &vPixelData;
+
+  EncodeFunctor(const void *p_vBuffer_, size_t szCount_, const DicomPixelFormat &stFormat_, std::vector<char> &vPixelData_)
+  : p_vBuffer(p_vBuffer_), szCount(szCount_), stFormat(stFormat_), vPixelData(vPixelData_) { }
+
+  template<typename ComponentType>
+  void Apply() { EncodeDicomPixelData((const ComponentType *)p_vBuffer, szCount, stFormat, vPixelData); }
+};
+
+} // end anonymous namespace
+
+bool IsDicomComponentType(itk::ImageIOBase::IOComponentType eComponentType) {
+  NullFunctor clFunctor;
+  return DispatchComponentType(eComponentType, clFunctor, DicomComponentTypes());
+}
+
+bool ReadDicomPixelData(itk::ImageIOBase *p_clImageIO, std::vector<char> &vBuffer) {
+  const unsigned int uiDimension = p_clImageIO->GetNumberOfDimensions();
+
+  itk::ImageIORegion clRegion(uiDimension);
+
+  for (unsigned int d = 0; d < uiDimension; ++d) {
+    clRegion.SetIndex(d, 0);
+    clRegion.SetSize(d, p_clImageIO->GetDimensions(d));
+  }
+
+  p_clImageIO->SetIORegion(clRegion);
+
+  vBuffer.resize(p_clImageIO->GetImageSizeInBytes());
+
+  if (vBuffer.empty())
+    return false;
+
+  try {
+    IOTimer clTimer; // ITK reads the file itself
+    p_clImageIO->Read(&vBuffer[0]);
+  }
+  catch (itk::ExceptionObject &e) {
+    std::cerr << "Error: " << e << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool SaveDicomPixelData(const std::string &strPath, itk::ImageIOBase::IOComponentType eComponentType, const void *p_vBuffer, size_t szCount, const itk::MetaDataDictionary &clDicomTags, const VerifyCallbackType &clVerify) {
+  // Start from the stored data set so geometry and everything else is written verbatim
+  gdcm::Reader clReader;
+  clReader.SetFileName(strPath.c_str());
+
+  bool bRead = false;
+
+  {
+    IOTimer clTimer; // gdcm reads the file itself, so parsing counts as well
+    bRead = clReader.Read();
+  }
+
+  if (!bRead) {
+    std::cerr << "Error: Could not read DICOM '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  gdcm::File &clFile = clReader.GetFile();
+
+  DicomPixelFormat stFormat;
+
+  if (!GetDicomPixelFormat(clFile, stFormat))
+    return false;
+
+  if (szCount != (size_t)stFormat.uiRows*stFormat.uiColumns*stFormat.uiSamplesPerPixel) {
+    std::cerr << "Error: Pixel data does not match the stored image dimensions." << std::endl;
+    return false;
+  }
+
+  std::vector<char> vPixelData;
+  EncodeFunctor clEncode(p_vBuffer, szCount, stFormat, vPixelData);
+
+  if (!DispatchComponentType(eComponentType, clEncode, DicomComponentTypes())) {
+    std::cerr << "Error: Unsupported pixel component type." << std::endl;
+    return false;
+  }
+
+  if (!SetDicomPixelData(clFile, stFormat, vPixelData) || !AddMissingDicomTags(clFile, clDicomTags))
+    return false;
+
+  return WriteDicomFile(clFile, strPath, true, clVerify);
+}
+
+uint64_t HashDicomPixelData(const gdcm::DataSet &clDataSet) {
+  uint64_t ui64Hash = HashBytes(nullptr, 0);
+
+  const gdcm::Tag clPixelDataTag(0x7fe0, 0x0010);
+
+  if (!clDataSet.FindDataElement(clPixelDataTag))
+    return ui64Hash;
+
+  const gdcm::DataElement &clElement = clDataSet.GetDataElement(clPixelDataTag);
+  const gdcm::ByteValue * const p_clByteValue = clElement.GetByteValue();
+
+  if (p_clByteValue != nullptr)
+    return HashBytes(p_clByteValue->GetPointer(), p_clByteValue->GetLength(), ui64Hash);
+
+  const gdcm::SequenceOfFragments * const p_clFragments = clElement.GetSequenceOfFragments();
+
+  if (p_clFragments == nullptr)
+    return ui64Hash;
+
+  const gdcm::ByteValue *p_clTable = p_clFragments->GetTable().GetByteValue();
+
+  if (p_clTable != nullptr)
+    ui64Hash = HashBytes(p_clTable->GetPointer(), p_clTable->GetLength(), ui64Hash);
+
+  for (size_t i = 0; i < p_clFragments->GetNumberOfFragments(); ++i) {
+    const gdcm::ByteValue * const p_clFragment = p_clFragments->GetFragment(i).GetByteValue();
+
+    if (p_clFragment != nullptr)
+      ui64Hash = HashBytes(p_clFragment->GetPointer(), p_clFragment->GetLength(), ui64Hash);
+  }
+
+  return ui64Hash;
+}
+
+bool VerifyDicomFile(const std::string &strPath, double dBValue, uint64_t ui64PixelHash) {
+  gdcm::Reader clReader;
+  clReader.SetFileName(strPath.c_str());
+
+  bool bRead = false;
+
+  {
+    IOTimer clTimer; // gdcm reads the file itself, so parsing counts as well
+    bRead = clReader.Read();
+  }
+
+  if (!bRead) {
+    std::cerr << "Error: Verify: '" << strPath << "' no longer parses." << std::endl;
+    return false;
+  }
+
+  const gdcm::File &clFile = clReader.GetFile();
+  const gdcm::DataSet &clDataSet = clFile.GetDataSet();
+
+  gdcm::StringFilter clFilter;
+  clFilter.SetFile(clFile);
+
+  double dStoredBValue = 0.0;
+
+  if (!GetDicomNumber(clFilter, clDataSet, gdcm::Tag(0x0018, 0x9087), dStoredBValue)) {
+    std::cerr << "Error: Verify: '" << strPath << "' has no readable (0018,9087)." << std::endl;
+    return false;
+  }
+
+  if (std::abs(dStoredBValue - dBValue) > 1e-6*std::max(1.0, std::abs(dBValue))) {
+    std::cerr << "Error: Verify: '" << strPath << "' has (0018,9087) = " << dStoredBValue << " instead of " << dBValue << '.' << std::endl;
+    return false;
+  }
+
+  if (HashDicomPixelData(clDataSet) != ui64PixelHash) {
+    std::cerr << "Error: Verify: Pixel Data of '" << strPath << "' changed." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool SaveDicomTags(const std::string &strPath, const itk::MetaDataDictionary &clDicomTags, const VerifyCallbackType &clVerify) {
+  gdcm::Reader clReader;
+  clReader.SetFileName(strPath.c_str());
+
+  bool bRead = false;
+
+  {
+    IOTimer clTimer; // gdcm reads the file itself, so parsing counts as well
+    bRead = clReader.Read();
+  }
+
+  if (!bRead) {
+    std::cerr << "Error: Could not read DICOM '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  gdcm::File &clFile = clReader.GetFile();
+
+  if (!AddMissingDicomTags(clFile, clDicomTags))
+    return false;
+
+  // Nothing in group 0002 changed, so let the writer leave the file meta information alone too
+  return WriteDicomFile(clFile, strPath, false, clVerify);
+}
+
+namespace {
+
+DicomWriteOptions g_stDicomWriteOptions;
+
+} // end anonymous namespace
+
+void SetDicomWriteOptions(const DicomWriteOptions &stOptions) {
+  g_stDicomWriteOptions = stOptions;
+}
+
+#ifdef __unix__
+namespace {
+
+// Give the new file the mode and extended attributes (ACLs included) of the one it replaces. Call after fchown() since
+// that can clear the set-user-ID and set-group-ID bits.
+bool CopyFileAttributes(const std::string &strFrom, const struct stat &stFrom, int iToFd) {
+  if (fchmod(iToFd, stFrom.st_mode & 07777) != 0) {
+    std::cerr << "Error: Could not keep the permissions of '" << strFrom << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+
+#ifdef __linux__
+  ssize_t sszSize = listxattr(strFrom.c_str(), nullptr, 0);
+
+  if (sszSize < 0) {
+    if (errno == ENOTSUP) // Nothing to keep
+      return true;
+
+    std::cerr << "Error: Could not list extended attributes of '" << strFrom << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  if (sszSize == 0)
+    return true;
+
+  std::vector<char> vNames((size_t)sszSize);
+  sszSize = listxattr(strFrom.c_str(), &vNames[0], vNames.size());
+
+  if (sszSize < 0) {
+    std::cerr << "Error: Could not list extended attributes of '" << strFrom << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  std::vector<char> vValue;
+
+  for (const char *p_cName = &vNames[0]; p_cName < &vNames[0] + sszSize; p_cName += std::strlen(p_cName) + 1) {
+    ssize_t sszValueSize = getxattr(strFrom.c_str(), p_cName, nullptr, 0);
+
+    if (sszValueSize >= 0) {
+      vValue.resize((size_t)sszValueSize + 1);
+      sszValueSize = getxattr(strFrom.c_str(), p_cName, &vValue[0], vValue.size());
+    }
+
+    if (sszValueSize < 0 || fsetxattr(iToFd, p_cName, &vValue[0], (size_t)sszValueSize, 0) != 0) {
+      std::cerr << "Error: Could not keep extended attribute '" << p_cName << "' of '" << strFrom << "': " << strerror(errno) << std::endl;
+      return false;
+    }
+  }
+#endif // __linux__
+
+  return true;
+}
+
+// Copy strFrom over strTo in place (so every hard link to strTo sees the new contents) and wait for it to reach the disk
+bool OverwriteFile(const std::string &strFrom, const std::string &strTo) {
+  IOTimer clTimer;
+
+  const int iFromFd = open(strFrom.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (iFromFd == -1)
+    return false;
+
+  const int iToFd = open(strTo.c_str(), O_WRONLY | O_CLOEXEC);
+
+  if (iToFd == -1) {
+    close(iFromFd);
+    return false;
+  }
+
+  std::vector<char> vBuffer(1 << 20);
+  uint64_t ui64Size = 0;
+  bool bSuccess = true;
+
+  while (bSuccess) {
+    const ssize_t sszSizeRead = read(iFromFd, &vBuffer[0], vBuffer.size());
+
+    if (sszSizeRead < 0 && errno == EINTR)
+      continue;
+
+    if (sszSizeRead <= 0) {
+      bSuccess = (sszSizeRead == 0);
+      break;
+    }
+
+    for (ssize_t sszWrote = 0; bSuccess && sszWrote < sszSizeRead; ) {
+      const ssize_t sszTmp = write(iToFd, &vBuffer[sszWrote], (size_t)(sszSizeRead - sszWrote));
+
+      if (sszTmp < 0 && errno == EINTR)
+        continue;
+
+      if (sszTmp <= 0)
+        bSuccess = false;
+      else
+        sszWrote += sszTmp;
     }
+
+    ui64Size += (uint64_t)sszSizeRead;
+  }
+
+  bSuccess = bSuccess && ftruncate(iToFd, (off_t)ui64Size) == 0;
+
+#ifdef __linux__
+  // Carry over the new file's modification time so a folder watcher sees the file it was told about
+  struct stat stFrom;
+  if (bSuccess && fstat(iFromFd, &stFrom) == 0) {
+    const struct timespec a_stTimes[2] = { stFrom.st_atim, stFrom.st_mtim };
+    futimens(iToFd, a_stTimes);
   }
+#endif // __linux__
+
+  bSuccess = bSuccess && fsync(iToFd) == 0;
+
+  close(iFromFd);
+
+  return close(iToFd) == 0 && bSuccess;
+}
+
+// Private temporary file in $TMPDIR (or /tmp) for when the new file cannot go beside the old one
+bool MakeTempFile(const std::string &strTargetPath, std::string &strTmpPath) {
+  const char * const p_cTmpFolder = getenv("TMPDIR");
+
+  std::string strTemplate = (p_cTmpFolder != nullptr && *p_cTmpFolder != '\0') ? p_cTmpFolder : "/tmp";
+  strTemplate += "/.";
+  strTemplate += BaseName(strTargetPath);
+  strTemplate += ".XXXXXX";
+
+  std::vector<char> vTemplate(strTemplate.begin(), strTemplate.end());
+  vTemplate.push_back('\0');
+
+  // Created with a unique name and mode 0600, so nobody else can swap in a symlink
+  const int iFd = mkstemp(&vTemplate[0]);
+
+  if (iFd == -1) {
+    std::cerr << "Error: Could not create a temporary file for '" << strTargetPath << "' in '" << strTemplate << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  close(iFd);
+
+  strTmpPath = &vTemplate[0];
+
+  return true;
+}
+
+bool SyncFolder(const std::string &strFolder) {
+  const int iFd = open(strFolder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (iFd == -1)
+    return false;
+
+  const bool bSuccess = (fsync(iFd) == 0);
+
+  close(iFd);
+
+  return bSuccess;
 }
 
+} // end anonymous namespace
+#endif // __unix__
+
+bool WriteDicomFile(const gdcm::File &clFile, const std::string &strPath, bool bCheckFileMetaInformation, const VerifyCallbackType &clVerify) {
+  std::string strTargetPath = strPath;
+
+#ifdef __unix__
+  // Write through symlinks to the file they point to (renaming over the link would replace the link instead)
+  char * const p_cRealPath = realpath(strPath.c_str(), nullptr);
+
+  if (p_cRealPath != nullptr) {
+    strTargetPath = p_cRealPath;
+    free(p_cRealPath);
+  }
+#endif // __unix__
+
+  std::string strTmpPath = DirName(strTargetPath);
+  strTmpPath += "/.";
+  strTmpPath += BaseName(strTargetPath);
+  strTmpPath += ".tmp";
+
+#ifdef __unix__
+  struct stat stBuff;
+  std::memset(&stBuff, 0, sizeof(stBuff));
+
+  if (stat(strTargetPath.c_str(), &stBuff) != 0) {
+    std::cerr << "Error: Could not stat '" << strTargetPath << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  // Renaming over a hard linked file would leave the other links with the old contents. Copying over the original
+  // in place keeps those and the owner, mode and extended attributes as they are.
+  bool bInPlace = (stBuff.st_nlink > 1);
+
+  // Without write access to the folder the new file cannot be made beside the old one (nor renamed over it)
+  if (access(DirName(strTargetPath).c_str(), W_OK) != 0) {
+    if (access(strTargetPath.c_str(), W_OK) != 0) {
+      std::cerr << "Error: Neither '" << strTargetPath << "' nor its folder is writable." << std::endl;
+      return false;
+    }
+
+    if (!MakeTempFile(strTargetPath, strTmpPath))
+      return false;
+
+    bInPlace = true;
+  }
+#endif // __unix__
+
+  // Wait for write budget before anything is written
+  if (g_stDicomWriteOptions.clBeforeWrite)
+    g_stDicomWriteOptions.clBeforeWrite(FileSize(strTargetPath));
+
+  {
+    gdcm::Writer clWriter;
+
+#ifdef __unix__
+    // The new file is about the size of the old one. Write it in a few large blocks rather than many small ones.
+    FileStreamBuffer clBuffer;
+    std::ostream clStream(&clBuffer);
+
+    clBuffer.SetDropCache(g_stDicomWriteOptions.bDropCache);
+
+    if (!clBuffer.Open(strTmpPath, (uint64_t)stBuff.st_size + 4096, g_stDicomWriteOptions.bDirectIO)) {
+      std::cerr << "Error: Could not open '" << strTmpPath << "' for writing: " << strerror(errno) << std::endl;
+      return false;
+    }
+
+    if (!bInPlace && fchown(clBuffer.GetFd(), stBuff.st_uid, stBuff.st_gid) != 0) {
+      // Not ours to give away (e.g. another user's file in a shared folder), so keep the original file instead
+      if (errno != EPERM || access(strTargetPath.c_str(), W_OK) != 0) {
+        std::cerr << "Error: Could not keep the owner and group of '" << strTargetPath << "': " << strerror(errno) << std::endl;
+        clBuffer.Close();
+        Unlink(strTmpPath);
+        return false;
+      }
+
+      bInPlace = true;
+    }
+
+    if (!bInPlace && !CopyFileAttributes(strTargetPath, stBuff, clBuffer.GetFd())) {
+      clBuffer.Close();
+      Unlink(strTmpPath);
+      return false;
+    }
+
+    clWriter.SetStream(clStream);
+#else // !__unix__
+    clWriter.SetFileName(strTmpPath.c_str());
+#endif // __unix__
+
+    clWriter.SetFile(clFile);
+    clWriter.SetCheckFileMetaInformation(bCheckFileMetaInformation);
+
+#ifndef __unix__
+    IOTimer clTimer; // gdcm writes the file itself
+#endif // !__unix__
+
+    bool bWritten = clWriter.Write();
+
+#ifdef __unix__
+    // The new contents must be on disk before they replace the only copy of the old ones
+    bWritten = clBuffer.Close(true) && bWritten;
+#endif // __unix__
+
+    if (!bWritten) {
+      std::cerr << "Error: Failed to write '" << strTmpPath << "'." << std::endl;
+      Unlink(strTmpPath);
+      return false;
+    }
+  }
+
+  if (clVerify && !clVerify(strTmpPath, clFile.GetDataSet())) {
+    std::cerr << "Error: New file for '" << strTargetPath << "' did not verify. Keeping the original." << std::endl;
+    Unlink(strTmpPath);
+    return false;
+  }
+
+#ifdef __unix__
+  if (bInPlace) {
+    // The complete copy stays around until the original has been overwritten
+    if (!OverwriteFile(strTmpPath, strTargetPath)) {
+      std::cerr << "Error: Failed to copy '" << strTmpPath << "' over '" << strTargetPath << "'. It may be incomplete, the new file is kept at '" << strTmpPath << "'." << std::endl;
+      return false;
+    }
+
+    Unlink(strTmpPath);
+    return true;
+  }
+#endif // __unix__
+
+  IOTimer clTimer;
+
+  if (!Rename(strTmpPath, strTargetPath, true)) {
+    std::cerr << "Error: Failed to rename '" << strTmpPath << "' to '" << strTargetPath << "'." << std::endl;
+    Unlink(strTmpPath);
+    return false;
+  }
+
+#ifdef __unix__
+  // Make the rename itself durable
+  if (!SyncFolder(DirName(strTargetPath)))
+    std::cerr << "Warning: Could not sync folder '" << DirName(strTargetPath) << "': " << strerror(errno) << std::endl;
+#endif // __unix__
+
+  return true;
+}
@@ -44,13 +44,17 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <cstdint>
 #include <cstring>
+#include <cmath>
 #include <algorithm>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "itkImage.h"
+#include "itkNumericTraits.h"
 #include "itkGDCMImageIO.h"
 #include "itkGDCMSeriesFileNames.h"
 #include "itkImageSeriesReader.h"
@@ -60,11 +64,40 @@
 #include "vnl/vnl_vector_fixed.h"
 #include "vnl/vnl_cross.h"
 
+#include "gdcmReader.h"
+#include "gdcmWriter.h"
+#include "gdcmFile.h"
+#include "gdcmCSAHeader.h"
+#include "gdcmCSAElement.h"
+
 void Trim(std::string &strString);
 std::vector<std::string> SplitString(const std::string &strValue, const std::string &strDelim);
 
+// 64-bit FNV-1a, the same on every platform and run
+uint64_t HashString(const std::string &strValue);
+
+// Continue a 64-bit FNV-1a hash over more bytes (start from the default)
+uint64_t HashBytes(const void *p_vData, size_t szSize, uint64_t ui64Hash = UINT64_C(14695981039346656037));
+
+bool IsHexDigit(char c);
+bool ParseITKTag(const std::string &strKey, uint16_t &ui16Group, uint16_t &ui16Element);
+
 bool FileExists(const std::string &strPath);
 bool IsFolder(const std::string &strPath);
+uint64_t FileSize(const std::string &strPath); // 0 on failure
+
+// Identifies the file (or folder) behind a path regardless of links and mount points
+struct FileId {
+  uint64_t ui64Device;
+  uint64_t ui64Inode;
+
+  bool operator==(const FileId &stOther) const { return ui64Device == stOther.ui64Device && ui64Inode == stOther.ui64Inode; }
+  bool operator!=(const FileId &stOther) const { return !(*this == stOther); }
+  bool operator<(const FileId &stOther) const { return ui64Device != stOther.ui64Device ? ui64Device < stOther.ui64Device : ui64Inode < stOther.ui64Inode; }
+};
+
+// Optionally also returns the hard link count
+bool GetFileId(const std::string &strPath, FileId &stId, unsigned int *p_uiNumLinks = nullptr);
 bool RmDir(const std::string &strPath);
 bool MkDir(const std::string &strPath);
 bool Unlink(const std::string &strPath);
@@ -72,13 +105,26 @@ bool Copy(const std::string &strFrom, const std::string &strTo, bool bReplace =
 bool Rename(const std::string &strFrom, const std::string &strTo, bool bReplace = false);
 void USleep(unsigned int uiMicroSeconds);
 
+// Time since the process was created (exec, loading of shared libraries and static initialization included)
+int64_t GetProcessAgeMilliSeconds();
+
 std::string BaseName(std::string strPath);
 std::string DirName(std::string strPath);
 
 void SanitizeFileName(std::string &strFileName); // Does NOT operate on paths
+
+// Write back any dirty pages of the file and ask the kernel to drop it from the page cache (does nothing on Windows)
+bool DropFileCache(const std::string &strPath);
+
+// Cheap DICOM test reading only the first 132 bytes (preamble + "DICM", or a plausible first element without preamble)
+bool IsDicomFile(const std::string &strPath);
 void FindFiles(const char *p_cDir, const char *p_cPattern, std::vector<std::string> &vFiles, bool bRecursive = false);
+
+// Like FindFiles() but hands each file to clVisit as it is listed instead of collecting them. Memory use only
+// grows with folder depth. Symlinks are followed except back into a folder being walked. Stops early if clVisit returns false.
+bool WalkFiles(const char *p_cDir, const char *p_cPattern, const std::function<bool(const std::string &)> &clVisit, bool bRecursive = false);
+
 void FindFolders(const char *p_cDir, const char *p_cPattern, std::vector<std::string> &vFolders, bool bRecursive = false);
-void FindDicomFolders(const char *p_cDir, const char *p_cPattern, std::vector<std::string> &vFolders, bool bRecursive = false);
 
 // Use LoadImg since Windows #defines LoadImage ... lame
 template<typename PixelType, unsigned int Dimension>
@@ -91,9 +137,111 @@ bool SaveImg(typename itk::Image<PixelType, Dimension>::Pointer p_clImage, const
 template<typename PixelType>
 typename itk::Image<PixelType, 3>::Pointer PromoteSlice(typename itk::Image<PixelType, 2>::Pointer p_clSlice, bool bDeepCopy = false);
 
-// Save a DICOM slice and keep all UIDs and private tags
-template<typename PixelType>
-bool SaveDicomSlice(typename itk::Image<PixelType, 2>::Pointer p_clImage, const std::string &strPath, bool bCompress = false);
+// How pixel values are stored in a DICOM data set
+struct DicomPixelFormat {
+  unsigned int uiRows;
+  unsigned int uiColumns;
+  unsigned int uiSamplesPerPixel;
+  unsigned int uiBitsAllocated;
+  bool bSigned;
+  double dRescaleSlope;
+  double dRescaleIntercept;
+};
+
+bool GetDicomPixelFormat(const gdcm::File &clFile, DicomPixelFormat &stFormat);
+
+// Convert (and un-rescale) pixel components to the stored little endian representation
+template<typename ComponentType>
+void EncodeDicomPixelData(const ComponentType *p_inBuffer, size_t szCount, const DicomPixelFormat &stFormat, std::vector<char> &vPixelData);
+
+// Replace Pixel Data with uncompressed samples. Compressed data sets become Explicit VR Little Endian.
+bool SetDicomPixelData(gdcm::File &clFile, const DicomPixelFormat &stFormat, const std::vector<char> &vPixelData);
+
+// Add tags from an ITK dictionary that are not already in the data set. Stored elements are left as they are.
+bool AddMissingDicomTags(gdcm::File &clFile, const itk::MetaDataDictionary &clDicomTags);
+
+// How WriteDicomFile() writes (set before any files are written)
+struct DicomWriteOptions {
+  bool bDirectIO; // Bypass the page cache (O_DIRECT) where the file system allows it
+  bool bDropCache; // Write back steadily and drop written pages from the page cache
+  std::function<void(uint64_t ui64Bytes)> clBeforeWrite; // Called from the writing thread with the expected size before each file is written (e.g. to wait for write budget)
+
+  DicomWriteOptions()
+  : bDirectIO(false), bDropCache(false) { }
+};
+
+void SetDicomWriteOptions(const DicomWriteOptions &stOptions);
+
+// Called with the complete new file and the data set written to it before it replaces the original. Returning false
+// keeps the original as it is.
+typedef std::function<bool(const std::string &strNewPath, const gdcm::DataSet &clDataSet)> VerifyCallbackType;
+
+// Write beside strPath, sync and rename over it keeping owner, mode and extended attributes. Symlinks are written
+// through. Hard linked files, files whose owner cannot be kept (not running as their owner or root) and files in
+// folders that are not writable are overwritten in place from the complete new file instead. That is written to
+// $TMPDIR when the folder is not writable, and kept if overwriting fails.
+bool WriteDicomFile(const gdcm::File &clFile, const std::string &strPath, bool bCheckFileMetaInformation = true, const VerifyCallbackType &clVerify = VerifyCallbackType());
+
+// Hash of the Pixel Data bytes as stored (the offset table and every fragment when encapsulated). Data sets without Pixel Data hash as empty.
+uint64_t HashDicomPixelData(const gdcm::DataSet &clDataSet);
+
+// Read strPath back in full and check that it parses, (0018,9087) holds dBValue and Pixel Data hashes to ui64PixelHash
+bool VerifyDicomFile(const std::string &strPath, double dBValue, uint64_t ui64PixelHash);
+
+// Add tags missing from the existing file strPath. Pixel Data is not decoded and the transfer syntax, encapsulated fragments and file meta information are kept as stored.
+bool SaveDicomTags(const std::string &strPath, const itk::MetaDataDictionary &clDicomTags, const VerifyCallbackType &clVerify = VerifyCallbackType());
+
+// Pixel component types that decoded pixel data can be re-encoded from
+template<typename... Types>
+struct TypeList { };
+
+typedef TypeList<unsigned char, char, unsigned short, short, unsigned int, int, float, double> DicomComponentTypes;
+
+// True if eComponentType is in DicomComponentTypes
+bool IsDicomComponentType(itk::ImageIOBase::IOComponentType eComponentType);
+
+// Decode all pixel data from an image IO that has already read the image information
+bool ReadDicomPixelData(itk::ImageIOBase *p_clImageIO, std::vector<char> &vBuffer);
+
+// Save decoded pixel data (szCount components) over the existing file strPath along with tags missing from the file. All other elements (UIDs, private tags, sequences, geometry) are written as stored.
+bool SaveDicomPixelData(const std::string &strPath, itk::ImageIOBase::IOComponentType eComponentType, const void *p_vBuffer, size_t szCount, const itk::MetaDataDictionary &clDicomTags, const VerifyCallbackType &clVerify = VerifyCallbackType());
+
+// Decode the base64 value ITK keeps for a binary private element (e.g. "0029|1010") as a Siemens CSA header
+bool GetCSAHeaderFromElement(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, gdcm::CSAHeader &clCSAHeader);
+
+// Raw bytes (name, type and items) of the named element of a Siemens CSA2 ("SV10") header, found by stepping over the others without decoding them.
+// Cheap enough to key caches on. False for CSA1 headers and for truncated or inconsistent ones.
+bool FindCSAElementBytes(const char *p_cData, size_t szSize, const char *p_cName, std::string &strBytes);
+
+// The same for the base64 value ITK keeps for a binary private element (e.g. "0029|1010")
+bool FindCSAElementBytes(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, const char *p_cName, std::string &strBytes);
+
+// Value of an element from FindCSAElementBytes() as ExposeCSAMetaData<std::string>() gives it: the non-empty items joined by '\\' without their padding
+bool GetCSAElementString(const std::string &strBytes, std::string &strValue);
+
+// Fixed size binary CSA element value
+template<typename ValueType>
+bool ExposeCSAMetaData(gdcm::CSAHeader &clHeader, const char *p_cKey, ValueType &value);
+
+// CSA element value as a string without its padding
+template<>
+bool ExposeCSAMetaData<std::string>(gdcm::CSAHeader &clHeader, const char *p_cKey, std::string &strValue);
+
+// Sequence Name b-value (e.g. *ep_b1000t or *ep_b1000#1) without logging anything
+bool ParseSequenceNameBValue(const std::string &strSequenceName, std::string &strBValue);
+
+// A single non-negative number no larger than 10000 (the ceiling all b-value parsers share), rounded to an integer string
+bool NormalizeBValue(const std::string &strValue, std::string &strBValue);
+
+// GE Slop_int_6 ... 9 (the first is the b-value, sometimes with a bogus leading digit)
+bool ParseGEBValue(const std::string &strValue, std::string &strBValue);
+
+// Philips Diffusion B-Factor as a number or as the base64 ITK keeps for an unknown FL
+bool ParsePhilipsBValue(const std::string &strValue, std::string &strBValue);
+
+// Whether an enhanced (multi-frame) file has (0018,9087) in the MR Diffusion Sequence (0018,9117) of its shared or per-frame
+// functional groups. strBValue is the normalized b-value, or empty when the frames disagree or it does not parse.
+bool FindFunctionalGroupBValue(const gdcm::DataSet &clDataSet, std::string &strBValue);
 
 template<typename PixelType, unsigned int Dimension>
 typename itk::Image<PixelType, Dimension>::Pointer LoadDicomImage(const std::string &strPath, const std::string &strSeriesUID = std::string());
@@ -174,7 +322,7 @@ typename itk::Image<PixelType, 3>::Pointer PromoteSlice(typename itk::Image<Pixe
   clOrigin3D[1] = clOrigin[1];
   clOrigin3D[2] = 0; // Default
   
-  itk::MetaDataDictionary clDicomTags = p_clSlice->GetMetaDataDictionary();
+  const itk::MetaDataDictionary &clDicomTags = p_clSlice->GetMetaDataDictionary();
   
   std::string strSpacingBetweenSlices; // 0018|0088
   
@@ -258,61 +406,31 @@ typename itk::Image<PixelType, 3>::Pointer PromoteSlice(typename itk::Image<Pixe
   return p_clSlice3D;
 }
 
-template<typename PixelType>
-bool SaveDicomSlice(typename itk::Image<PixelType, 2>::Pointer p_clSlice, const std::string &strFileName, bool bCompress) {
-  typedef itk::Image<PixelType, 2> ImageType;
-  typedef itk::Image<PixelType, 3> ImageType3D;
-  typedef itk::GDCMImageIO ImageIOType;
-  typedef itk::ImageFileWriter<ImageType> WriterType;
-  typedef itk::ImageFileWriter<ImageType3D> WriterType3D;
-  
-  if (!p_clSlice)
-    return false;
-  
-  typename ImageType3D::Pointer p_clSlice3D = PromoteSlice<PixelType>(p_clSlice);
-  
-  ImageIOType::Pointer p_clImageIO = ImageIOType::New();
-  
-  p_clImageIO->KeepOriginalUIDOn();
-  p_clImageIO->LoadPrivateTagsOn();
-  p_clImageIO->SetUseCompression(bCompress); // Maybe not needed?
-  
-  if (!p_clSlice3D) {
-    // Normal 2D DICOM?
-    typename WriterType::Pointer p_clWriter = WriterType::New();
-    
-    p_clWriter->SetImageIO(p_clImageIO);
-    p_clWriter->SetUseCompression(bCompress);
-    p_clWriter->SetFileName(strFileName);
-    p_clWriter->SetInput(p_clSlice);
-    
-    try {
-      p_clWriter->Update();
-    }
-    catch (itk::ExceptionObject &e) {
-      std::cerr << "Error: " << e << std::endl;
-      return false;
-    }
-    
-    return true;
-  }
-  
-  typename WriterType3D::Pointer p_clWriter3D = WriterType3D::New();
-  
-  p_clWriter3D->SetImageIO(p_clImageIO);
-  p_clWriter3D->SetUseCompression(bCompress);
-  p_clWriter3D->SetFileName(strFileName);
-  p_clWriter3D->SetInput(p_clSlice3D);
-  
-  try {
-    p_clWriter3D->Update();
-  }
-  catch (itk::ExceptionObject &e) {
-    std::cerr << "Error: " << e << std::endl;
-    return false;
+template<typename ComponentType>
+void EncodeDicomPixelData(const ComponentType *p_inBuffer, size_t szCount, const DicomPixelFormat &stFormat, std::vector<char> &vPixelData) {
+  const size_t szBytesPerSample = stFormat.uiBitsAllocated/8;
+  const bool bRescale = (stFormat.dRescaleSlope != 1.0 || stFormat.dRescaleIntercept != 0.0);
+
+  const double dMin = stFormat.bSigned ? -std::ldexp(1.0, stFormat.uiBitsAllocated-1) : 0.0;
+  const double dMax = stFormat.bSigned ? std::ldexp(1.0, stFormat.uiBitsAllocated-1) - 1.0 : std::ldexp(1.0, stFormat.uiBitsAllocated) - 1.0;
+
+  // Pixel Data must have even length
+  vPixelData.assign(szCount*szBytesPerSample + ((szCount*szBytesPerSample) & 1), 0);
+
+  for (size_t i = 0; i < szCount; ++i) {
+    double dValue = (double)p_inBuffer[i];
+
+    if (bRescale)
+      dValue = (dValue - stFormat.dRescaleIntercept) / stFormat.dRescaleSlope;
+
+    dValue = std::min(dMax, std::max(dMin, std::floor(dValue + 0.5)));
+
+    const uint64_t ui64Value = (uint64_t)(int64_t)dValue; // Two's complement for signed samples
+    char * const p = &vPixelData[i*szBytesPerSample];
+
+    for (size_t j = 0; j < szBytesPerSample; ++j)
+      p[j] = (char)((ui64Value >> (8*j)) & 0xff);
   }
-  
-  return true;
 }
 
 template<typename PixelType, unsigned int Dimension>
@@ -336,7 +454,7 @@ typename itk::Image<PixelType, Dimension>::Pointer LoadDicomImage(const std::str
     if (IsFolder(strPath)) // Must be a file
       return typename ImageType::Pointer();
     
-    if (!p_clImageIO->CanReadFile(strPath.c_str()))
+    if (!IsDicomFile(strPath))
       return typename ImageType::Pointer();
 
     typename ReaderType::Pointer p_clReader = ReaderType::New();
@@ -358,7 +476,7 @@ typename itk::Image<PixelType, Dimension>::Pointer LoadDicomImage(const std::str
   // Passed a file, read the series UID (ignore the one provided, if any)
   if (!IsFolder(strPath)) {
 
-    if (!p_clImageIO->CanReadFile(strPath.c_str()))
+    if (!IsDicomFile(strPath))
       return typename ImageType::Pointer();
 
     p_clImageIO->SetFileName(strPath.c_str());
@@ -423,4 +541,18 @@ typename itk::Image<PixelType, Dimension>::Pointer LoadDicomImage(const std::str
   return p_clReader->GetOutput();
 }
 
+template<typename ValueType>
+bool ExposeCSAMetaData(gdcm::CSAHeader &clHeader, const char *p_cKey, ValueType &value) {
+  if (!clHeader.FindCSAElementByName(p_cKey))
+    return false;
+
+  const gdcm::CSAElement &clElement = clHeader.GetCSAElementByName(p_cKey);
+  const gdcm::ByteValue * const p_clByteValue = clElement.GetByteValue();
+
+  if (p_clByteValue == nullptr || p_clByteValue->GetLength() != sizeof(ValueType))
+    return false;
+
+  return p_clByteValue->GetBuffer((char *)&value, sizeof(ValueType));
+}
+
 #endif // !COMMON_H
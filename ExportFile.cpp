@@ -0,0 +1,161 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <unordered_map>
+#include "ExportFile.h"
+
+namespace {
+
+const size_t g_szFlushSize = 1 << 20;
+
+std::atomic<uint64_t> g_ui64NextId(1);
+
+void AppendField(std::string &strLine, const std::string &strField) {
+  // Always quoted since paths and sequence names can contain anything
+  strLine += '"';
+
+  for (char c : strField) {
+    if (c == '"')
+      strLine += '"';
+
+    strLine += c;
+  }
+
+  strLine += '"';
+}
+
+} // end anonymous namespace
+
+ExportFile::ExportFile()
+: m_ui64Id(g_ui64NextId++) { }
+
+bool ExportFile::Open(const std::string &strPath) {
+  m_clStream.open(strPath.c_str(), std::ios::out | std::ios::app | std::ios::binary);
+
+  if (!m_clStream) {
+    std::cerr << "Error: Could not open export file '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  m_clStream.seekp(0, std::ios::end);
+
+  if (m_clStream.tellp() == std::streampos(0))
+    m_clStream << "path,series_instance_uid,instance_number,manufacturer,sequence_name,b_value,resolver,outcome\n";
+
+  return true;
+}
+
+void ExportFile::Add(const ExportRow &stRow) {
+  if (!IsOpen())
+    return;
+
+  ThreadBuffer &stBuffer = GetThreadBuffer();
+  std::string strFull;
+
+  {
+    std::unique_lock<std::mutex> clBufferLock(stBuffer.clMutex);
+    std::string &strBuffer = stBuffer.strData;
+
+    AppendField(strBuffer, stRow.strPath);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strSeriesInstanceUID);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strInstanceNumber);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strManufacturer);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strSequenceName);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strBValue);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strResolver);
+    strBuffer += ',';
+    AppendField(strBuffer, stRow.strOutcome);
+    strBuffer += '\n';
+
+    if (strBuffer.size() < g_szFlushSize)
+      return;
+
+    // Written outside the buffer lock so that Add() never holds both locks
+    strFull.reserve(strBuffer.capacity());
+    strFull.swap(strBuffer);
+  }
+
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+  m_clStream.write(strFull.data(), strFull.size());
+}
+
+bool ExportFile::Flush() {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  if (!m_clStream.is_open())
+    return true;
+
+  WriteBuffers();
+  m_clStream.flush();
+
+  return !m_clStream.fail();
+}
+
+bool ExportFile::Close() {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  if (!m_clStream.is_open())
+    return true;
+
+  WriteBuffers();
+
+  m_clStream.close();
+
+  return !m_clStream.fail();
+}
+
+void ExportFile::WriteBuffers() {
+  for (const std::unique_ptr<ThreadBuffer> &p_stBuffer : m_vBuffers) {
+    std::unique_lock<std::mutex> clBufferLock(p_stBuffer->clMutex);
+    m_clStream.write(p_stBuffer->strData.data(), p_stBuffer->strData.size());
+    p_stBuffer->strData.clear();
+  }
+}
+
+ExportFile::ThreadBuffer & ExportFile::GetThreadBuffer() {
+  thread_local std::unordered_map<uint64_t, ThreadBuffer *> mapBuffers;
+
+  auto itr = mapBuffers.find(m_ui64Id);
+
+  if (itr != mapBuffers.end())
+    return *itr->second;
+
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  m_vBuffers.emplace_back(new ThreadBuffer());
+  m_vBuffers.back()->strData.reserve(g_szFlushSize + 4096);
+
+  mapBuffers.emplace(m_ui64Id, m_vBuffers.back().get());
+
+  return *m_vBuffers.back();
+}
@@ -0,0 +1,88 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EXPORTFILE_H
+#define EXPORTFILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// What was learned about one file
+struct ExportRow {
+  std::string strPath;
+  std::string strSeriesInstanceUID;
+  std::string strInstanceNumber;
+  std::string strManufacturer;
+  std::string strSequenceName;
+  std::string strBValue;
+  std::string strResolver; // Which rule produced the b-value
+  std::string strOutcome;
+};
+
+// CSV table with one row per file, every field quoted. Rows are formatted into a buffer per thread and
+// written out in large blocks, so workers rarely contend and the table comes out of the same pass.
+class ExportFile {
+public:
+  ExportFile();
+
+  bool Open(const std::string &strPath);
+  bool IsOpen() const { return m_clStream.is_open(); }
+
+  // Thread safe
+  void Add(const ExportRow &stRow);
+
+  // Write out every thread's buffer now (e.g. periodically when Close() is far off). Thread safe.
+  bool Flush();
+
+  // Write what is left in every thread's buffer
+  bool Close();
+
+private:
+  // Only contended while being flushed
+  struct ThreadBuffer {
+    std::mutex clMutex;
+    std::string strData;
+  };
+
+  const uint64_t m_ui64Id; // Distinguishes this object in thread local lookups
+
+  std::mutex m_clMutex;
+  std::ofstream m_clStream;
+  std::vector<std::unique_ptr<ThreadBuffer>> m_vBuffers;
+
+  ExportFile(const ExportFile &) = delete;
+  ExportFile & operator=(const ExportFile &) = delete;
+
+  ThreadBuffer & GetThreadBuffer();
+
+  // m_clMutex must be held
+  void WriteBuffers();
+};
+
+#endif // !EXPORTFILE_H
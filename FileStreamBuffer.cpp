@@ -0,0 +1,284 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __unix__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include "FileStreamBuffer.h"
+#include "IOThrottle.h"
+
+const size_t FileStreamBuffer::DEFAULT_BUFFER_SIZE;
+const size_t FileStreamBuffer::DIRECT_ALIGNMENT;
+
+FileStreamBuffer::FileStreamBuffer()
+: m_iFd(-1), m_bDirect(false), m_bDropCache(false), m_bGood(false), m_bPreallocated(false), m_ui64Written(0), m_ui64WriteBackStarted(0), m_ui64Dropped(0),
+  m_p_cBuffer(nullptr), m_szBufferSize(DEFAULT_BUFFER_SIZE) { }
+
+FileStreamBuffer::~FileStreamBuffer() {
+  Close();
+  free(m_p_cBuffer);
+}
+
+bool FileStreamBuffer::Open(const std::string &strPath, uint64_t ui64SizeHint, bool bDirect) {
+  Close();
+
+  // O_DIRECT needs aligned memory
+  if (m_p_cBuffer == nullptr) {
+    void *p_vBuffer = nullptr;
+
+    if (posix_memalign(&p_vBuffer, DIRECT_ALIGNMENT, m_szBufferSize) != 0)
+      return false;
+
+    m_p_cBuffer = (char *)p_vBuffer;
+  }
+
+  const int iFlags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+  m_bDirect = false;
+
+#ifdef O_DIRECT
+  if (bDirect) {
+    m_iFd = open(strPath.c_str(), iFlags | O_DIRECT, 0666);
+    m_bDirect = (m_iFd != -1);
+  }
+#endif // O_DIRECT
+
+  if (m_iFd == -1) // Some file systems (e.g. tmpfs) refuse O_DIRECT
+    m_iFd = open(strPath.c_str(), iFlags, 0666);
+
+  if (m_iFd == -1)
+    return false;
+
+  m_bPreallocated = false;
+
+#ifdef __linux__
+  // Reserve the blocks in one go to avoid fragmentation. Not supported everywhere (e.g. NFS) ... that's OK.
+  // This extends the file, so Close() truncates it to what was actually written, which also frees what was not used.
+  if (ui64SizeHint > 0)
+    m_bPreallocated = (fallocate(m_iFd, 0, 0, (off_t)ui64SizeHint) == 0);
+#else // !__linux__
+  (void)ui64SizeHint;
+#endif // __linux__
+
+  m_bGood = true;
+  m_ui64Written = m_ui64WriteBackStarted = m_ui64Dropped = 0;
+  setp(m_p_cBuffer, m_p_cBuffer + m_szBufferSize);
+
+  return true;
+}
+
+bool FileStreamBuffer::Close(bool bSync) {
+  if (m_iFd == -1)
+    return m_bGood;
+
+  IOTimer clTimer;
+
+  FlushBuffer(true);
+
+  if (m_bPreallocated && m_bGood && ftruncate(m_iFd, (off_t)m_ui64Written) != 0) {
+    std::cerr << "Error: ftruncate() failed: " << strerror(errno) << std::endl;
+    m_bGood = false;
+  }
+
+  WriteBehind(true);
+
+  if (bSync && m_bGood && fsync(m_iFd) != 0) {
+    std::cerr << "Error: fsync() failed: " << strerror(errno) << std::endl;
+    m_bGood = false;
+  }
+
+  if (close(m_iFd) != 0)
+    m_bGood = false;
+
+  m_iFd = -1;
+  setp(nullptr, nullptr);
+
+  return m_bGood;
+}
+
+FileStreamBuffer::int_type FileStreamBuffer::overflow(int_type c) {
+  if (m_iFd == -1 || !FlushBuffer(false))
+    return traits_type::eof();
+
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+
+  return traits_type::not_eof(c);
+}
+
+std::streamsize FileStreamBuffer::xsputn(const char *p_cData, std::streamsize sszCount) {
+  if (m_iFd == -1)
+    return 0;
+
+  // Large blocks (e.g. Pixel Data) skip the copy when nothing needs to stay aligned
+  if (!m_bDirect && (size_t)sszCount >= m_szBufferSize) {
+    if (!FlushBuffer(false) || !WriteAll(p_cData, (size_t)sszCount))
+      return 0;
+
+    WriteBehind(false);
+
+    return sszCount;
+  }
+
+  std::streamsize sszWritten = 0;
+
+  while (sszWritten < sszCount) {
+    if (pptr() == epptr() && !FlushBuffer(false))
+      break;
+
+    const std::streamsize sszChunk = std::min<std::streamsize>(sszCount - sszWritten, epptr() - pptr());
+
+    std::memcpy(pptr(), p_cData + sszWritten, (size_t)sszChunk);
+    pbump((int)sszChunk);
+
+    sszWritten += sszChunk;
+  }
+
+  return sszWritten;
+}
+
+int FileStreamBuffer::sync() {
+  return FlushBuffer(false) ? 0 : -1;
+}
+
+bool FileStreamBuffer::FlushBuffer(bool bFinal) {
+  if (!m_bGood)
+    return false;
+
+  size_t szSize = (size_t)(pptr() - pbase());
+
+  if (m_bDirect && !bFinal)
+    szSize -= szSize % DIRECT_ALIGNMENT;
+
+  if (m_bDirect && bFinal && szSize % DIRECT_ALIGNMENT != 0) {
+    // Write the whole blocks directly, then the tail through the page cache
+    const size_t szAligned = szSize - szSize % DIRECT_ALIGNMENT;
+
+    if (!WriteAll(pbase(), szAligned) || !DisableDirect() || !WriteAll(pbase() + szAligned, szSize - szAligned))
+      m_bGood = false;
+  }
+  else if (!WriteAll(pbase(), szSize)) {
+    m_bGood = false;
+  }
+
+  // Keep any unaligned tail at the front
+  const size_t szLeft = (size_t)(pptr() - pbase()) - szSize;
+
+  if (szLeft > 0)
+    std::memmove(m_p_cBuffer, pbase() + szSize, szLeft);
+
+  setp(m_p_cBuffer, m_p_cBuffer + m_szBufferSize);
+  pbump((int)szLeft);
+
+  if (!bFinal)
+    WriteBehind(false);
+
+  return m_bGood;
+}
+
+bool FileStreamBuffer::WriteAll(const char *p_cData, size_t szSize) {
+  IOTimer clTimer;
+
+  while (szSize > 0) {
+    const ssize_t sszWritten = write(m_iFd, p_cData, szSize);
+
+    if (sszWritten < 0 && errno == EINTR)
+      continue;
+
+    if (sszWritten < 0 && errno == EINVAL && m_bDirect && DisableDirect())
+      continue; // File system accepted O_DIRECT at open but not for writes
+
+    if (sszWritten <= 0) {
+      std::cerr << "Error: write() failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+
+    p_cData += sszWritten;
+    szSize -= (size_t)sszWritten;
+    m_ui64Written += (uint64_t)sszWritten;
+  }
+
+  return true;
+}
+
+void FileStreamBuffer::WriteBehind(bool bFinal) {
+  if (!m_bDropCache || !m_bGood)
+    return;
+
+  IOTimer clTimer;
+
+#ifdef __linux__
+  if (bFinal) {
+    sync_file_range(m_iFd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    m_ui64WriteBackStarted = m_ui64Written;
+  }
+  else if (m_ui64WriteBackStarted > m_ui64Dropped) {
+    // The previous batch has had a whole buffer's worth of time to reach the disk
+    sync_file_range(m_iFd, (off64_t)m_ui64Dropped, (off64_t)(m_ui64WriteBackStarted - m_ui64Dropped), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  }
+
+  if (m_ui64WriteBackStarted > m_ui64Dropped) {
+    posix_fadvise(m_iFd, (off_t)m_ui64Dropped, (off_t)(m_ui64WriteBackStarted - m_ui64Dropped), POSIX_FADV_DONTNEED);
+    m_ui64Dropped = m_ui64WriteBackStarted;
+  }
+
+  // Start on what was just written without waiting for it
+  if (m_ui64Written > m_ui64WriteBackStarted) {
+    sync_file_range(m_iFd, (off64_t)m_ui64WriteBackStarted, (off64_t)(m_ui64Written - m_ui64WriteBackStarted), SYNC_FILE_RANGE_WRITE);
+    m_ui64WriteBackStarted = m_ui64Written;
+  }
+#else // !__linux__
+  // Only clean pages can be dropped, so this mostly helps at the end
+  if (bFinal) {
+    fdatasync(m_iFd);
+    posix_fadvise(m_iFd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+#endif // __linux__
+}
+
+bool FileStreamBuffer::DisableDirect() {
+#ifdef O_DIRECT
+  const int iFlags = fcntl(m_iFd, F_GETFL);
+
+  if (iFlags == -1 || fcntl(m_iFd, F_SETFL, iFlags & ~O_DIRECT) == -1)
+    return false;
+#endif // O_DIRECT
+
+  m_bDirect = false;
+
+  return true;
+}
+
+#endif // __unix__
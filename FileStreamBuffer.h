@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FILESTREAMBUFFER_H
+#define FILESTREAMBUFFER_H
+
+#ifdef __unix__
+
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+// Output for std::ostream in large blocks straight to a file descriptor. Space for the file can be
+// reserved up front, and writes can optionally bypass the page cache (O_DIRECT).
+class FileStreamBuffer : public std::streambuf {
+public:
+  static const size_t DEFAULT_BUFFER_SIZE = 4 << 20;
+  static const size_t DIRECT_ALIGNMENT = 4096;
+
+  FileStreamBuffer();
+  ~FileStreamBuffer();
+
+  // Create or truncate strPath. Reserves ui64SizeHint bytes (Linux fallocate) if not 0. Unused space is given back by Close().
+  bool Open(const std::string &strPath, uint64_t ui64SizeHint = 0, bool bDirect = false);
+  bool IsOpen() const { return m_iFd != -1; }
+  int GetFd() const { return m_iFd; }
+
+  // Write back steadily while writing and drop the written pages from the page cache
+  void SetDropCache(bool bDropCache) { m_bDropCache = bDropCache; }
+
+  // Write out what is left, optionally wait for it to reach the disk (fsync) and close. False if any write failed.
+  bool Close(bool bSync = false);
+
+protected:
+  virtual int_type overflow(int_type c) override;
+  virtual std::streamsize xsputn(const char *p_cData, std::streamsize sszCount) override;
+  virtual int sync() override;
+
+private:
+  int m_iFd;
+  bool m_bDirect;
+  bool m_bDropCache;
+  bool m_bGood;
+  bool m_bPreallocated; // The file was extended up front and must be truncated to m_ui64Written
+  uint64_t m_ui64Written;
+  uint64_t m_ui64WriteBackStarted; // Written back (or being) up to here
+  uint64_t m_ui64Dropped; // Dropped from the page cache up to here
+  char *m_p_cBuffer;
+  size_t m_szBufferSize;
+
+  FileStreamBuffer(const FileStreamBuffer &) = delete;
+  FileStreamBuffer & operator=(const FileStreamBuffer &) = delete;
+
+  // Only whole blocks are written with O_DIRECT unless bFinal
+  bool FlushBuffer(bool bFinal);
+  bool WriteAll(const char *p_cData, size_t szSize);
+  bool DisableDirect();
+  void WriteBehind(bool bFinal);
+};
+
+#endif // __unix__
+
+#endif // !FILESTREAMBUFFER_H
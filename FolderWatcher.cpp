@@ -0,0 +1,309 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "Common.h"
+#include "FolderWatcher.h"
+
+namespace {
+
+const uint32_t g_ui32WatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE | IN_ONLYDIR;
+
+} // end anonymous namespace
+
+FolderWatcher::FolderWatcher()
+: m_iFd(-1), m_bRecursive(false), m_clSettleTime(std::chrono::milliseconds(500)) {
+  m_iFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (m_iFd == -1)
+    std::cerr << "Error: inotify_init1() failed: " << strerror(errno) << std::endl;
+}
+
+FolderWatcher::~FolderWatcher() {
+  if (m_iFd != -1)
+    close(m_iFd);
+}
+
+bool FolderWatcher::AddFolder(const std::string &strFolder, bool bRecursive) {
+  if (!Good())
+    return false;
+
+  m_bRecursive = m_bRecursive || bRecursive;
+
+  if (!AddWatch(strFolder))
+    return false;
+
+  if (bRecursive) {
+    std::vector<std::string> vFolders;
+    FindFolders(strFolder.c_str(), "*", vFolders, true);
+
+    for (const std::string &strSubFolder : vFolders)
+      AddWatch(strSubFolder);
+  }
+
+  return true;
+}
+
+void FolderWatcher::MarkProcessed(const std::string &strPath, const std::string &strNewPath) {
+  GenerationType stGeneration;
+
+  if (!GetGeneration(strNewPath, stGeneration))
+    return;
+
+  ProcessedType stProcessed;
+  stProcessed.stGeneration = stGeneration;
+  stProcessed.bStale = false;
+
+  std::unique_lock<std::mutex> clLock(m_clProcessedMutex);
+  m_mapProcessed[strPath] = stProcessed;
+}
+
+bool FolderWatcher::Run(const CallbackType &clCallback, volatile sig_atomic_t &bStop) {
+  if (!Good())
+    return false;
+
+  const int iTimeout = 100; // Milliseconds
+  TimePointType clLastPrune = ClockType::now();
+
+  while (!bStop) {
+    struct pollfd stPoll;
+    std::memset(&stPoll, 0, sizeof(stPoll));
+
+    stPoll.fd = m_iFd;
+    stPoll.events = POLLIN;
+
+    const int iRet = poll(&stPoll, 1, iTimeout);
+
+    if (iRet < 0 && errno != EINTR) {
+      std::cerr << "Error: poll() failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+
+    if (iRet > 0 && (stPoll.revents & POLLIN))
+      ReadEvents();
+
+    Dispatch(clCallback);
+
+    if (m_clTickCallback)
+      m_clTickCallback();
+
+    const TimePointType clNow = ClockType::now();
+
+    if (clNow - clLastPrune > std::chrono::seconds(10)) {
+      PruneProcessed();
+      clLastPrune = clNow;
+    }
+  }
+
+  return true;
+}
+
+bool FolderWatcher::AddWatch(const std::string &strFolder) {
+  const int iWd = inotify_add_watch(m_iFd, strFolder.c_str(), g_ui32WatchMask);
+
+  if (iWd == -1) {
+    std::cerr << "Error: Could not watch '" << strFolder << "': " << strerror(errno) << std::endl;
+
+    if (errno == ENOSPC)
+      std::cerr << "Error: Consider raising fs.inotify.max_user_watches." << std::endl;
+
+    return false;
+  }
+
+  m_mapWatches[iWd] = strFolder;
+
+  return true;
+}
+
+void FolderWatcher::AddPending(const std::string &strPath, const TimePointType &clNow, bool bCreate) {
+  auto itr = m_mapPending.find(strPath);
+
+  if (itr != m_mapPending.end()) {
+    itr->second.clLastEvent = clNow;
+    return;
+  }
+
+  if (!bCreate)
+    return;
+
+  PendingType stPending;
+  stPending.clFirstEvent = stPending.clLastEvent = clNow;
+
+  m_mapPending.emplace(strPath, stPending);
+}
+
+void FolderWatcher::ReadEvents() {
+  alignas(struct inotify_event) char a_cBuffer[64*(sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+  ssize_t sszSizeRead = 0;
+  while ((sszSizeRead = read(m_iFd, a_cBuffer, sizeof(a_cBuffer))) > 0) {
+    const TimePointType clNow = ClockType::now();
+
+    for (const char *p = a_cBuffer; p < a_cBuffer + sszSizeRead; ) {
+      const struct inotify_event * const p_stEvent = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + p_stEvent->len;
+
+      if (p_stEvent->mask & IN_Q_OVERFLOW) {
+        std::cerr << "Warning: inotify event queue overflowed. Rescanning watched folders." << std::endl;
+        Rescan();
+        continue;
+      }
+
+      auto itr = m_mapWatches.find(p_stEvent->wd);
+
+      if (itr == m_mapWatches.end())
+        continue;
+
+      if (p_stEvent->mask & IN_IGNORED) {
+        m_mapWatches.erase(itr);
+        continue;
+      }
+
+      if (p_stEvent->len == 0)
+        continue;
+
+      std::string strPath = itr->second;
+      strPath += '/';
+      strPath += p_stEvent->name;
+
+      if (p_stEvent->mask & IN_ISDIR) {
+        if (m_bRecursive && (p_stEvent->mask & (IN_CREATE | IN_MOVED_TO))) {
+          // Files may have landed before the watch was in place
+          AddFolder(strPath, true);
+
+          std::vector<std::string> vFiles;
+          FindFiles(strPath.c_str(), "*", vFiles, true);
+
+          for (const std::string &strFile : vFiles)
+            AddPending(strFile, clNow);
+        }
+
+        continue;
+      }
+
+      if (p_stEvent->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        AddPending(strPath, clNow);
+      else if (p_stEvent->mask & IN_MODIFY)
+        AddPending(strPath, clNow, false); // Still being written
+    }
+  }
+}
+
+void FolderWatcher::Rescan() {
+  const TimePointType clNow = ClockType::now();
+  std::vector<std::string> vFiles;
+
+  for (const auto &clPair : m_mapWatches)
+    FindFiles(clPair.second.c_str(), "*", vFiles, false);
+
+  for (const std::string &strFile : vFiles)
+    AddPending(strFile, clNow);
+}
+
+void FolderWatcher::Dispatch(const CallbackType &clCallback) {
+  const TimePointType clNow = ClockType::now();
+
+  auto itr = m_mapPending.begin();
+  while (itr != m_mapPending.end()) {
+    if (clNow - itr->second.clLastEvent < m_clSettleTime) {
+      ++itr;
+      continue;
+    }
+
+    const std::string strPath = itr->first;
+    const TimePointType clFirstEvent = itr->second.clFirstEvent;
+
+    itr = m_mapPending.erase(itr);
+
+    GenerationType stGeneration;
+
+    if (!GetGeneration(strPath, stGeneration) || IsFolder(strPath)) // Temporary file?
+      continue;
+
+    {
+      // Rewriting a file generates its own events ... don't process it again unless it has been written since
+      std::unique_lock<std::mutex> clLock(m_clProcessedMutex);
+      auto itrProcessed = m_mapProcessed.find(strPath);
+
+      if (itrProcessed != m_mapProcessed.end()) {
+        const bool bOwnEvents = (itrProcessed->second.stGeneration == stGeneration);
+
+        m_mapProcessed.erase(itrProcessed);
+
+        if (bOwnEvents)
+          continue;
+      }
+    }
+
+    clCallback(strPath, clFirstEvent);
+  }
+}
+
+void FolderWatcher::PruneProcessed() {
+  std::unique_lock<std::mutex> clLock(m_clProcessedMutex);
+
+  // Entries whose events never arrived (e.g. the file was written over or removed since). A new entry
+  // may not match yet because the rewrite has not replaced the file, so only drop it on the second miss.
+  auto itr = m_mapProcessed.begin();
+  while (itr != m_mapProcessed.end()) {
+    GenerationType stGeneration;
+
+    if (m_mapPending.find(itr->first) != m_mapPending.end() || (GetGeneration(itr->first, stGeneration) && itr->second.stGeneration == stGeneration)) {
+      itr->second.bStale = false;
+      ++itr;
+    }
+    else if (itr->second.bStale)
+      itr = m_mapProcessed.erase(itr);
+    else {
+      itr->second.bStale = true;
+      ++itr;
+    }
+  }
+}
+
+bool FolderWatcher::GetGeneration(const std::string &strPath, GenerationType &stGeneration) {
+  struct stat stFile;
+
+  if (stat(strPath.c_str(), &stFile) != 0)
+    return false;
+
+  stGeneration.ui64Size = (uint64_t)stFile.st_size;
+  stGeneration.i64ModifiedSeconds = (int64_t)stFile.st_mtim.tv_sec;
+  stGeneration.lModifiedNanoSeconds = stFile.st_mtim.tv_nsec;
+
+  return true;
+}
+
+#endif // __linux__
@@ -0,0 +1,121 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#ifdef __linux__
+
+#include <csignal>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Watch folders with inotify and report files once they have finished being written
+class FolderWatcher {
+public:
+  typedef std::chrono::steady_clock ClockType;
+  typedef ClockType::time_point TimePointType;
+
+  // Called with the path and the time of the first event seen for that path
+  typedef std::function<void(const std::string &, const TimePointType &)> CallbackType;
+
+  // Called periodically from Run()
+  typedef std::function<void()> TickCallbackType;
+
+  // Identifies one version of a file's contents (the rename keeps it, any later write changes it)
+  struct GenerationType {
+    uint64_t ui64Size;
+    int64_t i64ModifiedSeconds;
+    long lModifiedNanoSeconds;
+
+    bool operator==(const GenerationType &stOther) const {
+      return ui64Size == stOther.ui64Size && i64ModifiedSeconds == stOther.i64ModifiedSeconds && lModifiedNanoSeconds == stOther.lModifiedNanoSeconds;
+    }
+  };
+
+  FolderWatcher();
+  ~FolderWatcher();
+
+  bool Good() const { return m_iFd != -1; }
+
+  // Files are reported once no event has been seen for them for this long
+  void SetSettleTime(unsigned int uiMilliSeconds) { m_clSettleTime = std::chrono::milliseconds(uiMilliSeconds); }
+
+  bool AddFolder(const std::string &strFolder, bool bRecursive = false);
+
+  void SetTickCallback(const TickCallbackType &clTickCallback) { m_clTickCallback = clTickCallback; }
+
+  // Files still settling
+  size_t GetNumPending() const { return m_mapPending.size(); }
+
+  // Ignore events caused by the callback rewriting strPath with strNewPath. Call this before strNewPath
+  // replaces strPath so the replacement's own events can never be dispatched first (thread safe).
+  void MarkProcessed(const std::string &strPath, const std::string &strNewPath);
+
+  // Loop until bStop is set (e.g. by a signal handler)
+  bool Run(const CallbackType &clCallback, volatile sig_atomic_t &bStop);
+
+  static bool GetGeneration(const std::string &strPath, GenerationType &stGeneration);
+
+private:
+  int m_iFd;
+  bool m_bRecursive;
+  ClockType::duration m_clSettleTime;
+  TickCallbackType m_clTickCallback;
+
+  struct PendingType {
+    TimePointType clFirstEvent;
+    TimePointType clLastEvent;
+  };
+
+  std::unordered_map<int, std::string> m_mapWatches;
+  std::unordered_map<std::string, PendingType> m_mapPending;
+
+  std::mutex m_clProcessedMutex;
+  struct ProcessedType {
+    GenerationType stGeneration; // The version the callback wrote
+    bool bStale; // Did not match the file at the last prune
+  };
+
+  std::unordered_map<std::string, ProcessedType> m_mapProcessed;
+
+  FolderWatcher(const FolderWatcher &) = delete;
+  FolderWatcher & operator=(const FolderWatcher &) = delete;
+
+  bool AddWatch(const std::string &strFolder);
+  void AddPending(const std::string &strPath, const TimePointType &clNow, bool bCreate = true);
+  void ReadEvents();
+  void Rescan();
+  void Dispatch(const CallbackType &clCallback);
+  void PruneProcessed();
+};
+
+#endif // __linux__
+
+#endif // !FOLDERWATCHER_H
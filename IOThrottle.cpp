@@ -0,0 +1,144 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include "IOThrottle.h"
+
+RateLimiter::RateLimiter(double dRatePerSecond)
+: m_dRate(dRatePerSecond), m_dTokens(dRatePerSecond), m_clLastRefill(ClockType::now()) { }
+
+void RateLimiter::Acquire(double dAmount) {
+  if (m_dRate <= 0.0)
+    return;
+
+  double dWaitSeconds = 0.0;
+
+  {
+    std::unique_lock<std::mutex> clLock(m_clMutex);
+
+    const ClockType::time_point clNow = ClockType::now();
+    const double dElapsed = std::chrono::duration<double>(clNow - m_clLastRefill).count();
+
+    m_clLastRefill = clNow;
+    m_dTokens = std::min(m_dRate, m_dTokens + dElapsed*m_dRate);
+
+    // Reserve now (possibly going into debt) so waiters are served in order
+    m_dTokens -= dAmount;
+
+    if (m_dTokens < 0.0)
+      dWaitSeconds = -m_dTokens/m_dRate;
+  }
+
+  if (dWaitSeconds > 0.0)
+    std::this_thread::sleep_for(std::chrono::duration<double>(dWaitSeconds));
+}
+
+namespace {
+
+thread_local IOTimer::ClockType::duration g_clThreadIOTime = IOTimer::ClockType::duration::zero();
+thread_local unsigned int g_uiThreadIODepth = 0;
+
+} // end anonymous namespace
+
+IOTimer::IOTimer()
+: m_clBegin(ClockType::now()) {
+  ++g_uiThreadIODepth;
+}
+
+IOTimer::~IOTimer() {
+  if (--g_uiThreadIODepth == 0)
+    g_clThreadIOTime += ClockType::now() - m_clBegin;
+}
+
+IOTimer::ClockType::duration IOTimer::GetThreadTotal() {
+  return g_clThreadIOTime;
+}
+
+IOThrottle::IOThrottle(unsigned int uiMaxConcurrency, double dReadBytesPerSecond, double dWriteBytesPerSecond, double dOpsPerSecond, double dTargetLatencyMs)
+: m_clReadLimiter(dReadBytesPerSecond), m_clWriteLimiter(dWriteBytesPerSecond), m_clOpsLimiter(dOpsPerSecond), 
+  m_uiMaxConcurrency(std::max(1u, uiMaxConcurrency)), m_uiConcurrency(m_uiMaxConcurrency), m_uiNumActive(0), m_dTargetLatencyMs(dTargetLatencyMs),
+  m_dTotalLatencyMs(0.0), m_uiNumSamples(0) { }
+
+void IOThrottle::BeginFile(uint64_t ui64BytesToRead) {
+  {
+    std::unique_lock<std::mutex> clLock(m_clMutex);
+
+    while (m_uiNumActive >= m_uiConcurrency)
+      m_clSlotCondition.wait(clLock);
+
+    ++m_uiNumActive;
+  }
+
+  m_clOpsLimiter.Acquire(1.0);
+  m_clReadLimiter.Acquire((double)ui64BytesToRead);
+}
+
+void IOThrottle::BeginWrite(uint64_t ui64BytesToWrite) {
+  m_clOpsLimiter.Acquire(1.0);
+  m_clWriteLimiter.Acquire((double)ui64BytesToWrite);
+}
+
+void IOThrottle::EndFile(const ClockType::duration &clIOTime) {
+  const double dLatencyMs = std::chrono::duration<double, std::milli>(clIOTime).count();
+
+  {
+    std::unique_lock<std::mutex> clLock(m_clMutex);
+
+    --m_uiNumActive;
+
+    if (m_dTargetLatencyMs > 0.0) {
+      m_dTotalLatencyMs += dLatencyMs;
+      ++m_uiNumSamples;
+
+      // Judge by the mean over roughly one round of in-flight files
+      if (m_uiNumSamples >= std::max(4u, m_uiConcurrency)) {
+        const double dMeanLatencyMs = m_dTotalLatencyMs / m_uiNumSamples;
+        const unsigned int uiOldConcurrency = m_uiConcurrency;
+
+        if (dMeanLatencyMs > m_dTargetLatencyMs)
+          m_uiConcurrency = std::max(1u, m_uiConcurrency - std::max(1u, m_uiConcurrency/4));
+        else if (dMeanLatencyMs < 0.8*m_dTargetLatencyMs && m_uiConcurrency < m_uiMaxConcurrency)
+          ++m_uiConcurrency;
+
+        if (m_uiConcurrency != uiOldConcurrency) {
+          std::cout << "Info: Mean I/O latency " << (unsigned int)dMeanLatencyMs << " ms (target " << (unsigned int)m_dTargetLatencyMs << 
+            " ms). Processing " << m_uiConcurrency << " file(s) at a time." << std::endl;
+        }
+
+        m_dTotalLatencyMs = 0.0;
+        m_uiNumSamples = 0;
+      }
+    }
+  }
+
+  m_clSlotCondition.notify_all();
+}
+
+unsigned int IOThrottle::GetConcurrency() const {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+  return m_uiConcurrency;
+}
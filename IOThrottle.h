@@ -0,0 +1,112 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IOTHROTTLE_H
+#define IOTHROTTLE_H
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+// Token bucket allowing up to one second worth of burst. Acquire() blocks until the amount is available.
+class RateLimiter {
+public:
+  typedef std::chrono::steady_clock ClockType;
+
+  // 0 means unlimited
+  explicit RateLimiter(double dRatePerSecond = 0.0);
+
+  void Acquire(double dAmount);
+
+private:
+  std::mutex m_clMutex;
+  double m_dRate;
+  double m_dTokens;
+  ClockType::time_point m_clLastRefill;
+
+  RateLimiter(const RateLimiter &) = delete;
+  RateLimiter & operator=(const RateLimiter &) = delete;
+};
+
+// Adds the time spent in its scope to the calling thread's I/O time (nested scopes count once). Wraps file reads and writes.
+class IOTimer {
+public:
+  typedef std::chrono::steady_clock ClockType;
+
+  IOTimer();
+  ~IOTimer();
+
+  // Total I/O time of the calling thread so far
+  static ClockType::duration GetThreadTotal();
+
+private:
+  ClockType::time_point m_clBegin;
+
+  IOTimer(const IOTimer &) = delete;
+  IOTimer & operator=(const IOTimer &) = delete;
+};
+
+// Limits read/write bandwidth and file operations, and adapts the number of files in flight to keep
+// per-file I/O latency near a target (additive increase, multiplicative decrease).
+class IOThrottle {
+public:
+  typedef std::chrono::steady_clock ClockType;
+
+  // Rates of 0 are unlimited and a target latency of 0 disables the adaptive concurrency
+  IOThrottle(unsigned int uiMaxConcurrency, double dReadBytesPerSecond, double dWriteBytesPerSecond, double dOpsPerSecond, double dTargetLatencyMs);
+
+  // Wait for a free slot and read budget
+  void BeginFile(uint64_t ui64BytesToRead);
+
+  // Wait for write budget right before a file is written
+  void BeginWrite(uint64_t ui64BytesToWrite);
+
+  // Release the slot and adjust concurrency to the file's I/O time (see IOTimer). Waiting for budget and CPU work do not count.
+  void EndFile(const ClockType::duration &clIOTime);
+
+  unsigned int GetConcurrency() const;
+
+private:
+  RateLimiter m_clReadLimiter;
+  RateLimiter m_clWriteLimiter;
+  RateLimiter m_clOpsLimiter;
+
+  mutable std::mutex m_clMutex;
+  std::condition_variable m_clSlotCondition;
+
+  unsigned int m_uiMaxConcurrency;
+  unsigned int m_uiConcurrency;
+  unsigned int m_uiNumActive;
+  double m_dTargetLatencyMs;
+
+  double m_dTotalLatencyMs;
+  unsigned int m_uiNumSamples;
+
+  IOThrottle(const IOThrottle &) = delete;
+  IOThrottle & operator=(const IOThrottle &) = delete;
+};
+
+#endif // !IOTHROTTLE_H
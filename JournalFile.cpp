@@ -0,0 +1,99 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include "Common.h"
+#include "JournalFile.h"
+
+bool JournalFile::Open(const std::string &strPath) {
+  bool bNeedNewLine = false;
+
+  {
+    std::ifstream clInStream(strPath.c_str());
+
+    // A missing file is just an empty journal
+    std::string strLine;
+    while (clInStream && std::getline(clInStream, strLine)) {
+      if (!strLine.empty())
+        m_setDone.insert(MakeKey(strLine));
+
+      bNeedNewLine = clInStream.eof(); // The last line was cut short by an interrupted run
+    }
+  }
+
+  m_szNumLoaded = m_setDone.size();
+
+  m_clStream.open(strPath.c_str(), std::ios::out | std::ios::app);
+
+  if (!m_clStream) {
+    std::cerr << "Error: Could not open journal '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  if (bNeedNewLine)
+    m_clStream << '\n';
+
+  std::cout << "Info: Loaded " << m_szNumLoaded << " finished file(s) from journal '" << strPath << "'." << std::endl;
+
+  return true;
+}
+
+bool JournalFile::Contains(const std::string &strPath) {
+  const KeyType stKey = MakeKey(strPath);
+
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+  return m_setDone.find(stKey) != m_setDone.end();
+}
+
+void JournalFile::Add(const std::string &strPath) {
+  const KeyType stKey = MakeKey(strPath);
+
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  if (!m_setDone.insert(stKey).second || !m_clStream.is_open())
+    return;
+
+  // Flushed right away so a killed run loses at most the files it was working on
+  m_clStream << strPath << std::endl;
+}
+
+bool JournalFile::Close() {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  if (!m_clStream.is_open())
+    return true;
+
+  m_clStream.close();
+
+  return !m_clStream.fail();
+}
+
+JournalFile::KeyType JournalFile::MakeKey(const std::string &strPath) {
+  KeyType stKey;
+  stKey.ui64Hash = HashString(strPath);
+  stKey.ui64Length = strPath.size();
+
+  return stKey;
+}
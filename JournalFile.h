@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JOURNALFILE_H
+#define JOURNALFILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// Paths of files that need no more work, one per line. Paths already in the file are loaded on Open()
+// and skipped, so running an interrupted run (or shard) again with the same journal picks up where it
+// stopped. Only a hash and the length of each path are kept in memory.
+class JournalFile {
+public:
+  JournalFile()
+  : m_szNumLoaded(0) { }
+
+  bool Open(const std::string &strPath);
+  bool IsOpen() const { return m_clStream.is_open(); }
+
+  // Thread safe
+  bool Contains(const std::string &strPath);
+  void Add(const std::string &strPath);
+
+  size_t GetNumLoaded() const { return m_szNumLoaded; }
+
+  bool Close();
+
+private:
+  struct KeyType {
+    uint64_t ui64Hash;
+    uint64_t ui64Length;
+
+    bool operator==(const KeyType &stOther) const { return ui64Hash == stOther.ui64Hash && ui64Length == stOther.ui64Length; }
+  };
+
+  struct KeyHash {
+    size_t operator()(const KeyType &stKey) const { return (size_t)stKey.ui64Hash; }
+  };
+
+  std::mutex m_clMutex;
+  std::ofstream m_clStream;
+  std::unordered_set<KeyType, KeyHash> m_setDone;
+  size_t m_szNumLoaded;
+
+  JournalFile(const JournalFile &) = delete;
+  JournalFile & operator=(const JournalFile &) = delete;
+
+  static KeyType MakeKey(const std::string &strPath);
+};
+
+#endif // !JOURNALFILE_H
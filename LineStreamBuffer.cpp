@@ -0,0 +1,91 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <mutex>
+#include <unordered_map>
+#include "LineStreamBuffer.h"
+
+namespace {
+
+// Shared by every instance so lines to std::cout and std::cerr don't mix either
+std::mutex g_clLineMutex;
+
+} // end anonymous namespace
+
+LineStreamBuffer::LineStreamBuffer(std::ostream &clStream)
+: m_clStream(clStream), m_p_clBuffer(clStream.rdbuf()) {
+  m_clStream.rdbuf(this);
+}
+
+LineStreamBuffer::~LineStreamBuffer() {
+  FlushLines(true);
+  m_clStream.rdbuf(m_p_clBuffer);
+}
+
+LineStreamBuffer::int_type LineStreamBuffer::overflow(int_type iC) {
+  if (traits_type::eq_int_type(iC, traits_type::eof()))
+    return traits_type::not_eof(iC);
+
+  GetLine().push_back(traits_type::to_char_type(iC));
+
+  if (traits_type::to_char_type(iC) == '\n')
+    FlushLines();
+
+  return iC;
+}
+
+std::streamsize LineStreamBuffer::xsputn(const char *p_cBuffer, std::streamsize sszSize) {
+  GetLine().append(p_cBuffer, (size_t)sszSize);
+  return sszSize;
+}
+
+int LineStreamBuffer::sync() {
+  // std::endl and std::cerr's unitbuf flush after every <<, so only hand over what ends in a newline
+  FlushLines();
+  return 0;
+}
+
+std::string & LineStreamBuffer::GetLine() {
+  // One pending line per thread and stream
+  thread_local std::unordered_map<const LineStreamBuffer *, std::string> mapLines;
+  return mapLines[this];
+}
+
+void LineStreamBuffer::FlushLines(bool bAll) {
+  std::string &strLine = GetLine();
+
+  const size_t szEnd = bAll ? strLine.size() : strLine.rfind('\n') + 1; // npos + 1 == 0
+
+  if (szEnd == 0)
+    return;
+
+  {
+    std::unique_lock<std::mutex> clLock(g_clLineMutex);
+    m_p_clBuffer->sputn(strLine.data(), (std::streamsize)szEnd);
+    m_p_clBuffer->pubsync();
+  }
+
+  strLine.erase(0, szEnd);
+}
@@ -0,0 +1,59 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LINESTREAMBUFFER_H
+#define LINESTREAMBUFFER_H
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+
+// Wraps the buffer of a standard stream so each thread's output reaches it one whole line at a time.
+// Lines written with several << from different workers (or to std::cout and std::cerr) no longer interleave.
+class LineStreamBuffer : public std::streambuf {
+public:
+  // Installs itself on clStream and puts the old buffer back when destroyed
+  explicit LineStreamBuffer(std::ostream &clStream);
+  ~LineStreamBuffer();
+
+protected:
+  virtual int_type overflow(int_type iC) override;
+  virtual std::streamsize xsputn(const char *p_cBuffer, std::streamsize sszSize) override;
+  virtual int sync() override;
+
+private:
+  std::ostream &m_clStream;
+  std::streambuf * const m_p_clBuffer;
+
+  std::string & GetLine();
+
+  // Pass on complete lines (or everything if bAll is set)
+  void FlushLines(bool bAll = false);
+
+  LineStreamBuffer(const LineStreamBuffer &) = delete;
+  LineStreamBuffer & operator=(const LineStreamBuffer &) = delete;
+};
+
+#endif // !LINESTREAMBUFFER_H
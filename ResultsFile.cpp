@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <map>
+#include "ResultsFile.h"
+
+bool ResultsFile::Open(const std::string &strPath, bool bPathsOnly) {
+  m_bPathsOnly = bPathsOnly;
+  m_clStream.open(strPath.c_str(), std::ios::out | std::ios::app);
+
+  if (!m_clStream) {
+    std::cerr << "Error: Could not open results file '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void ResultsFile::Add(const std::string &strPath, const char *p_cStatus) {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  if (!m_clStream.is_open())
+    return;
+
+  if (m_bPathsOnly)
+    m_clStream << strPath << '\n';
+  else
+    m_clStream << p_cStatus << '\t' << strPath << '\n';
+}
+
+bool ResultsFile::Close() {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  if (!m_clStream.is_open())
+    return true;
+
+  m_clStream.close();
+
+  return !m_clStream.fail();
+}
+
+bool MergeResultsFiles(const std::vector<std::string> &vInputs, const std::string &strOutput) {
+  std::map<std::string, std::string> mapStatus; // Path -> status
+
+  for (const std::string &strInput : vInputs) {
+    std::ifstream clStream(strInput.c_str());
+
+    if (!clStream) {
+      std::cerr << "Error: Could not open results file '" << strInput << "'." << std::endl;
+      return false;
+    }
+
+    std::string strLine;
+    while (std::getline(clStream, strLine)) {
+      const size_t p = strLine.find('\t');
+
+      if (p == std::string::npos) {
+        std::cerr << "Warning: Skipping malformed line in '" << strInput << "'." << std::endl;
+        continue;
+      }
+
+      mapStatus[strLine.substr(p+1)] = strLine.substr(0, p);
+    }
+  }
+
+  std::ofstream clOutStream(strOutput.c_str(), std::ios::out | std::ios::trunc);
+
+  if (!clOutStream) {
+    std::cerr << "Error: Could not open results file '" << strOutput << "'." << std::endl;
+    return false;
+  }
+
+  for (const auto &clPair : mapStatus)
+    clOutStream << clPair.second << '\t' << clPair.first << '\n';
+
+  clOutStream.close();
+
+  if (clOutStream.fail()) {
+    std::cerr << "Error: Failed to write results file '" << strOutput << "'." << std::endl;
+    return false;
+  }
+
+  std::cout << "Info: Merged " << mapStatus.size() << " result(s) into '" << strOutput << "'." << std::endl;
+
+  return true;
+}
@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RESULTSFILE_H
+#define RESULTSFILE_H
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One line per processed file ("status<TAB>path", or just the path to make a list for -f).
+// Appends so that an interrupted run keeps what it finished.
+class ResultsFile {
+public:
+  ResultsFile()
+  : m_bPathsOnly(false) { }
+
+  bool Open(const std::string &strPath, bool bPathsOnly = false);
+  bool IsOpen() const { return m_clStream.is_open(); }
+
+  // Thread safe
+  void Add(const std::string &strPath, const char *p_cStatus = "");
+
+  bool Close();
+
+private:
+  std::mutex m_clMutex;
+  std::ofstream m_clStream;
+  bool m_bPathsOnly;
+
+  ResultsFile(const ResultsFile &) = delete;
+  ResultsFile & operator=(const ResultsFile &) = delete;
+};
+
+// Combine results files (e.g. one per shard) sorted by path. The last status seen for a path wins.
+bool MergeResultsFiles(const std::vector<std::string> &vInputs, const std::string &strOutput);
+
+#endif // !RESULTSFILE_H
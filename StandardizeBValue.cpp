@@ -41,14 +41,32 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <csignal>
 #include <cstdlib>
 #include <cstdint>
 #include <cctype>
+#include <cmath>
 #include <cstring>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 #include <vector>
 #include "Common.h"
+#include "WorkerPool.h"
+#include "FolderWatcher.h"
+#include "ResultsFile.h"
+#include "IOThrottle.h"
+#include "ExportFile.h"
+#include "JournalFile.h"
+#include "LineStreamBuffer.h"
 #include "bsdgetopt.h"
 #include "strcasestr.h"
 
@@ -56,56 +74,317 @@
 #include "itkGDCMImageIO.h"
 #include "itkMetaDataDictionary.h"
 #include "itkMetaDataObject.h"
-#include "itkRGBPixel.h"
-#include "itkRGBAPixel.h"
 
 #include "gdcmBase64.h"
 #include "gdcmCSAHeader.h"
 #include "gdcmCSAElement.h"
+#include "gdcmReader.h"
+#include "gdcmStringFilter.h"
  
 void Usage(const char *p_cArg0) {
-  std::cerr << "Usage: " << p_cArg0 << " [-hr] path|filePattern [path2|filePattern2 ...]" << std::endl;
+  std::cerr << "Usage: " << p_cArg0 << " [-0dDhnNprSuV] [-c exportFile] [-f listFile] [-F failuresFile] [-I filesPerSecond] [-j numThreads] [-J journalFile] [-L targetLatencyMs] [-o resultsFile] [-R readMBPerSecond] [-s shard/numShards] [-W writeMBPerSecond] [path|filePattern path2|filePattern2 ...]" << std::endl;
+  std::cerr << "       " << p_cArg0 << " -m -o mergedResultsFile resultsFile [resultsFile2 ...]" << std::endl;
   std::cerr << "\nOptions:" << std::endl;
+  std::cerr << "-0 -- Paths in the list file are separated by null characters instead of newlines (reads standard input without -f)." << std::endl;
+  std::cerr << "-c -- Append a CSV row per file (path, series, instance, manufacturer, sequence name, b-value, resolver, outcome) to this file (with -s, the shard number is appended to the name)." << std::endl;
+  std::cerr << "-d -- Watch the given folders and standardize files as they arrive (Linux only)." << std::endl;
+  std::cerr << "-D -- Write rewritten files with direct I/O, bypassing the page cache (e.g. for cold archives)." << std::endl;
+  std::cerr << "-f -- Also process the files listed in this file, one per line ('-' for standard input). Paths are not searched or expanded." << std::endl;
+  std::cerr << "-F -- Append the paths of files that failed to read, write or verify to this file, for retrying with -f (with -s, the shard number is appended to the name)." << std::endl;
   std::cerr << "-h -- This help message." << std::endl;
+  std::cerr << "-I -- Limit file reads and writes per second (default unlimited)." << std::endl;
+  std::cerr << "-j -- Number of files to process concurrently (default 1)." << std::endl;
+  std::cerr << "-J -- Record files that need no more work in this journal and skip the files already in it, to resume an interrupted run (with -s, the shard number is appended to the name)." << std::endl;
+  std::cerr << "-L -- Process fewer files concurrently while the mean I/O time per file is above this many milliseconds (default off)." << std::endl;
+  std::cerr << "-m -- Merge results files (e.g. one per shard) into the file given by -o." << std::endl;
+  std::cerr << "-n -- Dry run. Determine and report b-values (with -c, -o) but do not modify any file." << std::endl;
+  std::cerr << "-N -- Drop each file from the page cache once it is done, and write back rewritten files steadily (Linux), to go easy on other services." << std::endl;
+  std::cerr << "-o -- Append the outcome for each file to this file (with -s, the shard number is appended to the name)." << std::endl;
+  std::cerr << "-p -- Process folders that look like diffusion series first, smallest files first." << std::endl;
   std::cerr << "-r -- Recursively search folders." << std::endl;
+  std::cerr << "-R -- Limit reading to this many MB per second (default unlimited)." << std::endl;
+  std::cerr << "-s -- Only process this shard's share of the folders (e.g. 2/8 for shard 2 of 8, counting from 0)." << std::endl;
+  std::cerr << "-S -- Strict. Files whose b-value could not be determined make the run fail (exit status 2)." << std::endl;
+  std::cerr << "-u -- Decompress pixel data when rewriting (default keeps the original transfer syntax and pixel data)." << std::endl;
+  std::cerr << "-V -- Read each new file back before it replaces the original and check that it parses, holds the b-value and that Pixel Data is as written." << std::endl;
+  std::cerr << "-W -- Limit writing to this many MB per second (default unlimited)." << std::endl;
+  std::cerr << "\nExit status is 0 if every file was standardized or skipped, otherwise the worst of:" << std::endl;
+  std::cerr << "1 -- Bad arguments or the results could not be written." << std::endl;
+  std::cerr << "2 -- The b-value could not be determined for some file (-S only)." << std::endl;
+  std::cerr << "3 -- Some file has an unsupported pixel type (-u)." << std::endl;
+  std::cerr << "4 -- Some file could not be read." << std::endl;
+  std::cerr << "5 -- Some file could not be written." << std::endl;
+  std::cerr << "6 -- Some new file failed verification and the original was kept (-V)." << std::endl;
   exit(1);
 }
 
-bool IsHexDigit(char c);
-bool ParseITKTag(const std::string &strKey, uint16_t &ui16Group, uint16_t &ui16Element);
-
-template<typename ValueType>
-bool ExposeCSAMetaData(gdcm::CSAHeader &clHeader, const char *p_cKey, ValueType &value);
-
-template<>
-bool ExposeCSAMetaData<std::string>(gdcm::CSAHeader &clHeader, const char *p_cKey, std::string &strValue);
-
-bool GetCSAHeaderFromElement(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, gdcm::CSAHeader &clCSAHeader);
-
-std::string ComputeDiffusionBValue(const itk::MetaDataDictionary &clDicomTags);
-std::string ComputeDiffusionBValueSiemens(const itk::MetaDataDictionary &clDicomTags);
+// Optionally reports which rule produced the b-value
+std::string ComputeDiffusionBValue(const itk::MetaDataDictionary &clDicomTags, std::string *p_strResolver = nullptr);
+std::string ComputeDiffusionBValueSiemens(const itk::MetaDataDictionary &clDicomTags, std::string *p_strResolver = nullptr);
 std::string ComputeDiffusionBValueGE(const itk::MetaDataDictionary &clDicomTags);
 std::string ComputeDiffusionBValueProstateX(const itk::MetaDataDictionary &clDicomTags); // Same as Skyra and Verio
 std::string ComputeDiffusionBValuePhilips(const itk::MetaDataDictionary &clDicomTags);
 
-bool StandardizeBValue(const std::string &strFileName);
-
-template<typename PixelType>
-bool StandardizeBValueHelper(const std::string &strFileName);
+// Private element p_cKey, unless its private creator element p_cCreatorKey is present and does not contain p_cCreator (case insensitive)
+bool ExposePrivateMetaData(const itk::MetaDataDictionary &clDicomTags, const char *p_cKey, const char *p_cCreatorKey, const char *p_cCreator, std::string &strValue);
+
+// Ordered from best to worst
+enum OutcomeType {
+  OUTCOME_STANDARDIZED = 0,
+  OUTCOME_ALREADY_STANDARDIZED,
+  OUTCOME_NOT_DICOM,
+  OUTCOME_NOT_MR,
+  OUTCOME_NO_BVALUE,
+  OUTCOME_UNSUPPORTED,
+  OUTCOME_READ_FAILED,
+  OUTCOME_WRITE_FAILED,
+  OUTCOME_VERIFY_FAILED,
+  NUM_OUTCOMES
+};
+
+const char * GetOutcomeName(OutcomeType eOutcome);
+
+// 0 when there was nothing to do, otherwise distinct per category. Files without a b-value (e.g. T2 series
+// next to the diffusion series) are only counted as failures when bStrict.
+int GetOutcomeExitCode(OutcomeType eOutcome, bool bStrict = false);
+
+// Failures that may go away when tried again (e.g. I/O errors on network storage)
+bool IsRetryable(OutcomeType eOutcome);
+
+// Partial parse (up to (0020,0013)) that settles non-MR and already standardized files without ITK. Returns false if eOutcome was decided.
+bool PrefilterDicomFile(const std::string &strFileName, OutcomeType &eOutcome, ExportRow *p_stRow = nullptr);
+
+// Higher is more likely to be a diffusion series
+int ComputeDiffusionScore(const std::string &strFolder, const std::string &strFile);
+
+// Keep only the first path to each file (hard links, symlinks, bind mounts). Returns the number removed.
+size_t RemoveDuplicateFiles(std::vector<std::string> &vFiles);
+
+// Likely diffusion folders first, then by file size within each folder
+void PrioritizeFiles(std::vector<std::string> &vFiles);
+
+// Hand each path in the list ("-" for standard input) to clVisit as it is read
+bool ReadFileList(const std::string &strListFile, char cDelimiter, const std::function<bool(const std::string &)> &clVisit);
+
+struct Options {
+  bool bRecursive;
+  bool bDecompress;
+  bool bDirectIO;
+  bool bDropCache;
+  bool bDryRun; // Resolve b-values but write nothing
+  bool bVerify; // Read each rewritten file back and check it
+  bool bStrict; // Files without a b-value fail the run
+  bool bPrioritize;
+  unsigned int uiNumThreads;
+  std::string strListFile; // "-" for standard input
+  char cListDelimiter;
+  unsigned int uiShardIndex;
+  unsigned int uiNumShards;
+  std::string strResultsFile;
+  std::string strFailuresFile;
+  std::string strJournalFile;
+  std::string strExportFile;
+  double dReadMBPerSecond; // 0 is unlimited
+  double dWriteMBPerSecond;
+  double dFilesPerSecond;
+  double dTargetLatencyMs; // 0 disables adaptive concurrency
+
+  Options()
+  : bRecursive(false), bDecompress(false), bDirectIO(false), bDropCache(false), bDryRun(false), bVerify(false), bStrict(false), bPrioritize(false), uiNumThreads(1), cListDelimiter('\n'), uiShardIndex(0), uiNumShards(1),
+    dReadMBPerSecond(0.0), dWriteMBPerSecond(0.0), dFilesPerSecond(0.0), dTargetLatencyMs(0.0) { }
+
+  // Whether files keyed by strKey (a folder) belong to this shard
+  bool OwnsShard(const std::string &strKey) const;
+};
+
+// Files under strRoot are keyed by their top-level folder so a series never spans shards
+std::string GetShardKey(const std::string &strRoot, const std::string &strFile);
+
+// Called with the original and the new path just before a rewritten file replaces the original. Return false to keep the original.
+typedef std::function<bool(const std::string &strFileName, const std::string &strNewPath)> ReplaceCallbackType;
+
+// Optionally fills in p_stRow (except path and outcome) for the export table
+OutcomeType StandardizeBValue(const std::string &strFileName, const Options &stOptions, ExportRow *p_stRow = nullptr, const ReplaceCallbackType &clReplace = ReplaceCallbackType());
+
+// State shared by the workers of one run
+class Session {
+public:
+  explicit Session(const Options &stOptions);
+
+  // Open the results and failures files
+  bool Open();
+
+  // Standardize one file within the I/O limits and record the outcome (thread safe)
+  OutcomeType ProcessFile(const std::string &strFile);
+
+  unsigned int GetConcurrency() const { return m_clThrottle.GetConcurrency(); }
+
+  // Write out buffered export rows (thread safe)
+  bool FlushExport() { return m_clExport.Flush(); }
+
+  // Set before processing starts
+  void SetReplaceCallback(const ReplaceCallbackType &clReplace) { m_clReplace = clReplace; }
+
+  // Counts per outcome and per b-value resolver, and throughput
+  void PrintSummary() const;
+
+  // Returns the exit code for the worst outcome seen (1 if the results could not be written)
+  int Close();
+
+private:
+  const Options &m_stOptions;
+  IOThrottle m_clThrottle;
+  ResultsFile m_clResults;
+  ResultsFile m_clFailures;
+  JournalFile m_clJournal;
+  ExportFile m_clExport;
+  ReplaceCallbackType m_clReplace;
+  std::atomic<uint64_t> m_a_ui64Counts[NUM_OUTCOMES];
+  std::once_flag m_clFirstFileFlag;
+  std::atomic<uint64_t> m_ui64NumBytes;
+  std::atomic<uint64_t> m_ui64NumJournaled;
+  std::chrono::steady_clock::time_point m_clBeginTime;
+  mutable std::mutex m_clResolverMutex;
+  std::map<std::string, uint64_t> m_mapResolverCounts;
+
+  Session(const Session &) = delete;
+  Session & operator=(const Session &) = delete;
+};
+
+// Gather every file first (needed for -p)
+int RunBatch(const std::vector<std::string> &vPaths, const Options &stOptions);
+
+// Discovery feeds a bounded queue so memory use does not grow with the number of files
+int RunStreaming(const std::vector<std::string> &vPaths, const Options &stOptions);
+
+#ifdef __linux__
+int RunDaemon(const std::vector<std::string> &vFolders, const Options &stOptions);
+#endif // __linux__
+
+bool ParsePositiveNumber(const char *p_cValue, double &dValue);
 
 int main(int argc, char **argv) {
   const char * const p_cArg0 = argv[0];
+
+  // Workers log concurrently
+  LineStreamBuffer clCoutBuffer(std::cout), clCerrBuffer(std::cerr);
   
-  bool bRecursive = false;
+  Options stOptions;
+  bool bDaemon = false;
+  bool bMerge = false;
   
   int c = 0;
-  while ((c = getopt(argc, argv, "hr")) != -1) {
+  while ((c = getopt(argc, argv, "0c:dDf:F:hI:j:J:L:mnNo:prR:s:SuVW:")) != -1) {
     switch (c) {
+    case '0':
+      stOptions.cListDelimiter = '\0';
+      break;
+    case 'c':
+      stOptions.strExportFile = optarg;
+      break;
+    case 'd':
+      bDaemon = true;
+      break;
+    case 'D':
+      stOptions.bDirectIO = true;
+      break;
+    case 'f':
+      stOptions.strListFile = optarg;
+      break;
+    case 'F':
+      stOptions.strFailuresFile = optarg;
+      break;
     case 'h':
       Usage(p_cArg0);
       break;
+    case 'I':
+      if (!ParsePositiveNumber(optarg, stOptions.dFilesPerSecond)) {
+        std::cerr << "Error: Invalid number of file operations per second '" << optarg << "'." << std::endl;
+        Usage(p_cArg0);
+      }
+      break;
+    case 'j':
+      {
+        char *p = nullptr;
+        const unsigned long ulTmp = strtoul(optarg, &p, 10);
+
+        if (*p != '\0' || ulTmp == 0 || ulTmp > 1024) {
+          std::cerr << "Error: Invalid number of threads '" << optarg << "'." << std::endl;
+          Usage(p_cArg0);
+        }
+
+        stOptions.uiNumThreads = (unsigned int)ulTmp;
+      }
+      break;
+    case 'J':
+      stOptions.strJournalFile = optarg;
+      break;
+    case 'L':
+      if (!ParsePositiveNumber(optarg, stOptions.dTargetLatencyMs)) {
+        std::cerr << "Error: Invalid target latency '" << optarg << "'." << std::endl;
+        Usage(p_cArg0);
+      }
+      break;
+    case 'm':
+      bMerge = true;
+      break;
+    case 'n':
+      stOptions.bDryRun = true;
+      break;
+    case 'N':
+      stOptions.bDropCache = true;
+      break;
+    case 'o':
+      stOptions.strResultsFile = optarg;
+      break;
+    case 'p':
+      stOptions.bPrioritize = true;
+      break;
     case 'r':
-      bRecursive = true;
+      stOptions.bRecursive = true;
+      break;
+    case 'R':
+      if (!ParsePositiveNumber(optarg, stOptions.dReadMBPerSecond)) {
+        std::cerr << "Error: Invalid read bandwidth '" << optarg << "'." << std::endl;
+        Usage(p_cArg0);
+      }
+      break;
+    case 'S':
+      stOptions.bStrict = true;
+      break;
+    case 's':
+      {
+        char *p = nullptr;
+        const unsigned long ulIndex = strtoul(optarg, &p, 10);
+
+        if (p == optarg || *p != '/') {
+          std::cerr << "Error: Invalid shard '" << optarg << "' (expected i/N)." << std::endl;
+          Usage(p_cArg0);
+        }
+
+        char * const p_cCount = p+1;
+        const unsigned long ulCount = strtoul(p_cCount, &p, 10);
+
+        if (p == p_cCount || *p != '\0' || ulCount == 0 || ulCount > 65536 || ulIndex >= ulCount) {
+          std::cerr << "Error: Invalid shard '" << optarg << "' (expected i/N with 0 <= i < N)." << std::endl;
+          Usage(p_cArg0);
+        }
+
+        stOptions.uiShardIndex = (unsigned int)ulIndex;
+        stOptions.uiNumShards = (unsigned int)ulCount;
+      }
+      break;
+    case 'u':
+      stOptions.bDecompress = true;
+      break;
+    case 'V':
+      stOptions.bVerify = true;
+      break;
+    case 'W':
+      if (!ParsePositiveNumber(optarg, stOptions.dWriteMBPerSecond)) {
+        std::cerr << "Error: Invalid write bandwidth '" << optarg << "'." << std::endl;
+        Usage(p_cArg0);
+      }
       break;
     case '?':
     default:
@@ -115,150 +394,736 @@ int main(int argc, char **argv) {
   
   argc -= optind;
   argv += optind;
+
+  if (bMerge) {
+    if (argc <= 0 || stOptions.strResultsFile.empty()) {
+      std::cerr << "Error: Merging needs -o and at least one results file." << std::endl;
+      Usage(p_cArg0);
+    }
+
+    return MergeResultsFiles(std::vector<std::string>(argv, argv + argc), stOptions.strResultsFile) ? 0 : 1;
+  }
+
+  if (stOptions.cListDelimiter == '\0' && stOptions.strListFile.empty())
+    stOptions.strListFile = "-";
   
-  if (argc <= 0)
+  if (argc <= 0 && stOptions.strListFile.empty())
     Usage(p_cArg0);
+
+  if (bDaemon && !stOptions.strListFile.empty()) {
+    std::cerr << "Error: File lists cannot be used when watching folders." << std::endl;
+    return 1;
+  }
+
+  if (bDaemon && !stOptions.strJournalFile.empty()) {
+    std::cerr << "Error: A journal cannot be used when watching folders (files arriving again must be processed again)." << std::endl;
+    return 1;
+  }
+
+  if (bDaemon && stOptions.uiNumShards > 1) {
+    std::cerr << "Error: Sharding cannot be used when watching folders." << std::endl;
+    return 1;
+  }
+
+  // Each shard gets its own results file, combine them afterward with -m
+  if (stOptions.uiNumShards > 1) {
+    const std::string strSuffix = "." + std::to_string(stOptions.uiShardIndex);
+
+    if (!stOptions.strResultsFile.empty())
+      stOptions.strResultsFile += strSuffix;
+
+    if (!stOptions.strFailuresFile.empty())
+      stOptions.strFailuresFile += strSuffix;
+
+    if (!stOptions.strJournalFile.empty())
+      stOptions.strJournalFile += strSuffix;
+
+    if (!stOptions.strExportFile.empty())
+      stOptions.strExportFile += strSuffix;
+  }
+
+  const std::vector<std::string> vPaths(argv, argv + argc);
+
+  if (bDaemon) {
+#ifdef __linux__
+    return RunDaemon(vPaths, stOptions);
+#else // !__linux__
+    std::cerr << "Error: Watching folders is only supported on Linux." << std::endl;
+    return 1;
+#endif // __linux__
+  }
   
+  // Ordering needs the whole list up front, otherwise start on files as soon as they are found
+  return stOptions.bPrioritize ? RunBatch(vPaths, stOptions) : RunStreaming(vPaths, stOptions);
+}
+
+bool ParsePositiveNumber(const char *p_cValue, double &dValue) {
+  char *p = nullptr;
+  dValue = strtod(p_cValue, &p);
+
+  return p != p_cValue && *p == '\0' && std::isfinite(dValue) && dValue > 0.0;
+}
+
+bool Options::OwnsShard(const std::string &strKey) const {
+  return uiNumShards <= 1 || HashString(strKey) % uiNumShards == uiShardIndex;
+}
+
+std::string GetShardKey(const std::string &strRoot, const std::string &strFile) {
+  if (strFile.size() <= strRoot.size() + 1 || strFile.compare(0, strRoot.size(), strRoot) != 0)
+    return DirName(strFile);
+
+  // The top-level folder under strRoot (or strRoot itself for files directly in it)
+  const size_t p = strFile.find_first_of("/\\", strRoot.size() + 1);
+
+  return p != std::string::npos ? strFile.substr(0, p) : strRoot;
+}
+
+const char * GetOutcomeName(OutcomeType eOutcome) {
+  switch (eOutcome) {
+  case OUTCOME_STANDARDIZED:
+    return "standardized";
+  case OUTCOME_ALREADY_STANDARDIZED:
+    return "already_standardized";
+  case OUTCOME_NOT_DICOM:
+    return "not_dicom";
+  case OUTCOME_NOT_MR:
+    return "not_mr";
+  case OUTCOME_NO_BVALUE:
+    return "no_bvalue";
+  case OUTCOME_UNSUPPORTED:
+    return "unsupported";
+  case OUTCOME_READ_FAILED:
+    return "read_failed";
+  case OUTCOME_WRITE_FAILED:
+    return "write_failed";
+  case OUTCOME_VERIFY_FAILED:
+    return "verify_failed";
+  default:
+    break;
+  }
+
+  return "unknown";
+}
+
+int GetOutcomeExitCode(OutcomeType eOutcome, bool bStrict) {
+  switch (eOutcome) {
+  case OUTCOME_NO_BVALUE:
+    return bStrict ? 2 : 0;
+  case OUTCOME_UNSUPPORTED:
+    return 3;
+  case OUTCOME_READ_FAILED:
+    return 4;
+  case OUTCOME_WRITE_FAILED:
+    return 5;
+  case OUTCOME_VERIFY_FAILED:
+    return 6;
+  default: // Nothing to do for these files
+    break;
+  }
+
+  return 0;
+}
+
+bool IsRetryable(OutcomeType eOutcome) {
+  return eOutcome == OUTCOME_READ_FAILED || eOutcome == OUTCOME_WRITE_FAILED || eOutcome == OUTCOME_VERIFY_FAILED;
+}
+
+Session::Session(const Options &stOptions)
+: m_stOptions(stOptions), 
+  m_clThrottle(stOptions.uiNumThreads, 1e6*stOptions.dReadMBPerSecond, 1e6*stOptions.dWriteMBPerSecond, stOptions.dFilesPerSecond, stOptions.dTargetLatencyMs) {
+  for (std::atomic<uint64_t> &ui64Count : m_a_ui64Counts)
+    ui64Count = 0;
+
+  m_ui64NumBytes = 0;
+  m_ui64NumJournaled = 0;
+  m_clBeginTime = std::chrono::steady_clock::now();
+}
+
+bool Session::Open() {
+  DicomWriteOptions stWriteOptions;
+  stWriteOptions.bDirectIO = m_stOptions.bDirectIO;
+  stWriteOptions.bDropCache = m_stOptions.bDropCache;
+
+  // Take write budget right before the write rather than after the file is done
+  stWriteOptions.clBeforeWrite = [this](uint64_t ui64Bytes) {
+    m_clThrottle.BeginWrite(ui64Bytes);
+  };
+
+  SetDicomWriteOptions(stWriteOptions);
+
+  if (!m_stOptions.strResultsFile.empty() && !m_clResults.Open(m_stOptions.strResultsFile))
+    return false;
+
+  if (!m_stOptions.strFailuresFile.empty() && !m_clFailures.Open(m_stOptions.strFailuresFile, true))
+    return false;
+
+  if (!m_stOptions.strJournalFile.empty() && !m_clJournal.Open(m_stOptions.strJournalFile))
+    return false;
+
+  if (!m_stOptions.strExportFile.empty() && !m_clExport.Open(m_stOptions.strExportFile))
+    return false;
+
+  return true;
+}
+
+OutcomeType Session::ProcessFile(const std::string &strFile) {
+  if (m_clJournal.IsOpen() && m_clJournal.Contains(strFile)) {
+    std::cout << "Info: Skipping '" << strFile << "' (done in an earlier run)." << std::endl;
+    ++m_ui64NumJournaled;
+    return OUTCOME_ALREADY_STANDARDIZED; // Nothing left to do
+  }
+
+  // Whole file reads and rewrites, so the file size is a good estimate for both
+  const uint64_t ui64Size = FileSize(strFile);
+
+  // Only time spent reading and writing counts toward latency
+  const IOTimer::ClockType::duration clIOBegin = IOTimer::GetThreadTotal();
+
+  m_clThrottle.BeginFile(ui64Size);
+
+  // For tracking startup cost when invoked many times on small batches
+  std::call_once(m_clFirstFileFlag, []() {
+    std::cout << "Info: Time to first file = " << GetProcessAgeMilliSeconds() << " ms" << std::endl;
+  });
+
+  std::cout << "Info: Processing '" << strFile << "' ..." << std::endl;
+
+  ExportRow stRow;
+
+  const OutcomeType eOutcome = StandardizeBValue(strFile, m_stOptions, &stRow, m_clReplace);
+
+  m_clThrottle.EndFile(IOTimer::GetThreadTotal() - clIOBegin);
+
+  m_ui64NumBytes += ui64Size;
+
+  // Also covers files that were only read
+  if (m_stOptions.bDropCache)
+    DropFileCache(strFile);
+
+  ++m_a_ui64Counts[eOutcome];
+
+  if (!stRow.strBValue.empty()) {
+    std::unique_lock<std::mutex> clLock(m_clResolverMutex);
+    ++m_mapResolverCounts[stRow.strResolver];
+  }
+
+  m_clResults.Add(strFile, GetOutcomeName(eOutcome));
+
+  if (IsRetryable(eOutcome))
+    m_clFailures.Add(strFile);
+  else if (!m_stOptions.bDryRun)
+    m_clJournal.Add(strFile);
+
+  if (m_clExport.IsOpen()) {
+    stRow.strPath = strFile;
+    stRow.strOutcome = GetOutcomeName(eOutcome);
+    m_clExport.Add(stRow);
+  }
+
+  return eOutcome;
+}
+
+void Session::PrintSummary() const {
+  std::cout << "Info:";
+
+  for (int i = 0; i < NUM_OUTCOMES; ++i)
+    std::cout << (i > 0 ? ", " : " ") << GetOutcomeName((OutcomeType)i) << " = " << m_a_ui64Counts[i];
+
+  std::cout << std::endl;
+
+  uint64_t ui64NumFiles = 0;
+
+  for (const std::atomic<uint64_t> &ui64Count : m_a_ui64Counts)
+    ui64NumFiles += ui64Count;
+
+  const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_clBeginTime).count();
+  const double dMB = m_ui64NumBytes/1e6;
+
+  if (dSeconds > 0.0)
+    std::cout << "Info: " << ui64NumFiles << " files (" << dMB << " MB) in " << dSeconds << " s (" << ui64NumFiles/dSeconds << " files/s, " << dMB/dSeconds << " MB/s)" << std::endl;
+
+  if (m_clJournal.IsOpen())
+    std::cout << "Info: " << m_ui64NumJournaled << " file(s) skipped as done according to the journal" << std::endl;
+
+  std::unique_lock<std::mutex> clLock(m_clResolverMutex);
+
+  if (m_mapResolverCounts.empty())
+    return;
+
+  std::cout << "Info: b-values from";
+
+  for (auto itr = m_mapResolverCounts.begin(); itr != m_mapResolverCounts.end(); ++itr)
+    std::cout << (itr != m_mapResolverCounts.begin() ? ", " : " ") << itr->first << " = " << itr->second;
+
+  std::cout << std::endl;
+}
+
+int Session::Close() {
+  int iExitCode = 0;
+
+  for (int i = 0; i < NUM_OUTCOMES; ++i) {
+    if (m_a_ui64Counts[i] > 0)
+      iExitCode = std::max(iExitCode, GetOutcomeExitCode((OutcomeType)i, m_stOptions.bStrict));
+  }
+
+  if (!m_clResults.Close()) {
+    std::cerr << "Error: Failed to write results file '" << m_stOptions.strResultsFile << "'." << std::endl;
+    iExitCode = std::max(iExitCode, 1);
+  }
+
+  if (!m_clFailures.Close()) {
+    std::cerr << "Error: Failed to write failures file '" << m_stOptions.strFailuresFile << "'." << std::endl;
+    iExitCode = std::max(iExitCode, 1);
+  }
+
+  if (!m_clJournal.Close()) {
+    std::cerr << "Error: Failed to write journal '" << m_stOptions.strJournalFile << "'." << std::endl;
+    iExitCode = std::max(iExitCode, 1);
+  }
+
+  if (!m_clExport.Close()) {
+    std::cerr << "Error: Failed to write export file '" << m_stOptions.strExportFile << "'." << std::endl;
+    iExitCode = std::max(iExitCode, 1);
+  }
+
+  return iExitCode;
+}
+
+int RunBatch(const std::vector<std::string> &vPaths, const Options &stOptions) {
   std::vector<std::string> vFiles;
 
-  for (int i = 0; i < argc; ++i) {
-    const char * const p_cFile = argv[i];
+  for (const std::string &strPath : vPaths) {
+    const size_t szBegin = vFiles.size();
+    std::string strRoot;
 
-    if (strpbrk(p_cFile, "?*") != nullptr) {
+    if (strpbrk(strPath.c_str(), "?*") != nullptr) {
       // DOS wildcard pattern
-      FindFiles(DirName(p_cFile).c_str(), p_cFile, vFiles, bRecursive);
+      strRoot = DirName(strPath);
+      FindFiles(strRoot.c_str(), BaseName(strPath).c_str(), vFiles, stOptions.bRecursive);
     }
-    else if (IsFolder(p_cFile)) {
+    else if (IsFolder(strPath)) {
       // Directory
-      FindFiles(p_cFile, "*", vFiles, bRecursive);
+      strRoot = strPath;
+      FindFiles(strRoot.c_str(), "*", vFiles, stOptions.bRecursive);
     }
     else {
       // Individual file
-      vFiles.push_back(p_cFile);
+      vFiles.push_back(strPath);
+    }
+
+    if (stOptions.uiNumShards > 1) {
+      auto itr = std::remove_if(vFiles.begin() + szBegin, vFiles.end(),
+        [&stOptions, &strRoot](const std::string &strFile) -> bool {
+          return !stOptions.OwnsShard(strRoot.empty() ? DirName(strFile) : GetShardKey(strRoot, strFile));
+        });
+
+      vFiles.erase(itr, vFiles.end());
     }
   }
 
-  for (const std::string &strFile : vFiles) {
-    std::cout << "Info: Processing '" << strFile << "' ..." << std::endl;
-    StandardizeBValue(strFile);
+  if (!stOptions.strListFile.empty()) {
+    const bool bSuccess = ReadFileList(stOptions.strListFile, stOptions.cListDelimiter, [&vFiles, &stOptions](const std::string &strFile) -> bool {
+      if (stOptions.OwnsShard(DirName(strFile)))
+        vFiles.push_back(strFile);
+
+      return true;
+    });
+
+    if (!bSuccess)
+      return 1;
   }
 
-  std::cout << "Done." << std::endl;
+  // Rewriting the same inode through two paths would race
+  const size_t szNumDuplicates = RemoveDuplicateFiles(vFiles);
 
-  return 0;
-}
+  if (szNumDuplicates > 0)
+    std::cout << "Info: Skipping " << szNumDuplicates << " duplicate path(s)." << std::endl;
 
-bool IsHexDigit(char c) {
-  if (std::isdigit(c))
-    return true;
+  if (stOptions.bPrioritize)
+    PrioritizeFiles(vFiles);
 
-  switch (std::tolower(c)) {
-  case 'a':
-  case 'b':
-  case 'c':
-  case 'd':
-  case 'e':
-  case 'f':
-    return true;
+  Session clSession(stOptions);
+
+  if (!clSession.Open())
+    return 1;
+
+  {
+    WorkerPool clPool(stOptions.uiNumThreads);
+
+    for (const std::string &strFile : vFiles) {
+      clPool.Push([&clSession, strFile]() {
+        clSession.ProcessFile(strFile);
+      });
+    }
+
+    clPool.Wait();
   }
 
-  return false;
+  clSession.PrintSummary();
+
+  const int iExitCode = clSession.Close();
+
+  std::cout << "Done." << std::endl;
+
+  return iExitCode;
 }
 
-bool ParseITKTag(const std::string &strKey, uint16_t &ui16Group, uint16_t &ui16Element) {
-  if (strKey.empty() || !IsHexDigit(strKey[0]))
-    return false;
+bool ReadFileList(const std::string &strListFile, char cDelimiter, const std::function<bool(const std::string &)> &clVisit) {
+  std::ifstream clListStream;
 
-  ui16Group = ui16Element = 0;
+  if (strListFile != "-") {
+    clListStream.open(strListFile.c_str());
 
-  char *p = nullptr;
-  unsigned long ulTmp = strtoul(strKey.c_str(), &p, 16);
+    if (!clListStream) {
+      std::cerr << "Error: Could not open file list '" << strListFile << "'." << std::endl;
+      return false;
+    }
+  }
 
-  if (*p != '|' || *(p+1) == '\0' || ulTmp > std::numeric_limits<uint16_t>::max())
-    return false;
+  std::istream &clStream = strListFile != "-" ? clListStream : std::cin;
 
-  ui16Group = (uint16_t)ulTmp;
+  std::string strLine;
+  while (std::getline(clStream, strLine, cDelimiter)) {
+    if (cDelimiter == '\n' && !strLine.empty() && strLine.back() == '\r')
+      strLine.pop_back(); // Written on Windows
 
-  ulTmp = strtoul(p+1, &p, 16);
+    if (strLine.empty())
+      continue;
 
-  if (*p != '\0' || ulTmp > std::numeric_limits<uint16_t>::max())
-    return false;
+    if (!clVisit(strLine))
+      break;
+  }
 
-  ui16Element = (uint16_t)ulTmp;
+  if (clStream.bad()) {
+    std::cerr << "Error: Failed to read file list '" << strListFile << "'." << std::endl;
+    return false;
+  }
 
   return true;
 }
 
-template<typename ValueType>
-bool ExposeCSAMetaData(gdcm::CSAHeader &clHeader, const char *p_cKey, ValueType &value) {
-  if (!clHeader.FindCSAElementByName(p_cKey))
-    return false;
+int RunStreaming(const std::vector<std::string> &vPaths, const Options &stOptions) {
+  Session clSession(stOptions);
 
-  const gdcm::CSAElement &clElement = clHeader.GetCSAElementByName(p_cKey);
-  const gdcm::ByteValue * const p_clByteValue = clElement.GetByteValue();
+  if (!clSession.Open())
+    return 1;
 
-  if (p_clByteValue == nullptr || p_clByteValue->GetLength() != sizeof(ValueType))
-    return false;
+  WorkerPool clPool(stOptions.uiNumThreads, 4*stOptions.uiNumThreads);
 
-  return p_clByteValue->GetBuffer((char *)&value, sizeof(ValueType));
-}
+  // Only files with more than one hard link need remembering, and only until every link has been seen
+  struct HardLinkType {
+    std::string strPath;
+    unsigned int uiNumUnseen;
+  };
 
-template<>
-bool ExposeCSAMetaData<std::string>(gdcm::CSAHeader &clHeader, const char *p_cKey, std::string &strValue) {
-  if (!clHeader.FindCSAElementByName(p_cKey))
-    return false;
+  std::mutex clFileIdMutex;
+  std::map<FileId, HardLinkType> mapHardLinks;
+  std::set<FileId> setInProgress; // Same file reached through symlinks at the same time
 
-  const gdcm::CSAElement &clElement = clHeader.GetCSAElementByName(p_cKey);
-  const gdcm::ByteValue * const p_clByteValue = clElement.GetByteValue();
+  auto clVisit = [&](const std::string &strFile) -> bool {
+    clPool.Push([&clFileIdMutex, &mapHardLinks, &setInProgress, &clSession, strFile]() {
+      FileId stId;
+      unsigned int uiNumLinks = 0;
 
-  if (p_clByteValue == nullptr)
-    return false;
+      const bool bHaveId = GetFileId(strFile, stId, &uiNumLinks);
 
-  std::vector<char> vBuffer(p_clByteValue->GetLength());
-  if (!p_clByteValue->GetBuffer(&vBuffer[0], vBuffer.size()))
-    return false;
+      if (bHaveId) {
+        std::unique_lock<std::mutex> clLock(clFileIdMutex);
 
-  strValue.assign(vBuffer.begin(), vBuffer.end());
+        if (uiNumLinks > 1) {
+          auto itr = mapHardLinks.find(stId);
 
-  return true;
+          if (itr != mapHardLinks.end()) {
+            std::cout << "Info: '" << strFile << "' is the same file as '" << itr->second.strPath << "'." << std::endl;
+
+            if (--itr->second.uiNumUnseen == 0)
+              mapHardLinks.erase(itr);
+
+            return;
+          }
+
+          HardLinkType stHardLink;
+          stHardLink.strPath = strFile;
+          stHardLink.uiNumUnseen = uiNumLinks - 1;
+
+          mapHardLinks.emplace(stId, stHardLink);
+        }
+
+        if (!setInProgress.insert(stId).second) {
+          std::cout << "Info: '" << strFile << "' is already being processed through another path." << std::endl;
+          return;
+        }
+      }
+
+      clSession.ProcessFile(strFile);
+
+      if (bHaveId) {
+        std::unique_lock<std::mutex> clLock(clFileIdMutex);
+        setInProgress.erase(stId);
+      }
+    });
+
+    return true;
+  };
+
+  // Only the shard's own top-level folders are walked
+  auto WalkShard = [&](const std::string &strDir, const char *p_cPattern) {
+    if (stOptions.uiNumShards <= 1) {
+      WalkFiles(strDir.c_str(), p_cPattern, clVisit, stOptions.bRecursive);
+      return;
+    }
+
+    if (stOptions.OwnsShard(strDir))
+      WalkFiles(strDir.c_str(), p_cPattern, clVisit, false);
+
+    if (!stOptions.bRecursive)
+      return;
+
+    std::vector<std::string> vFolders;
+    FindFolders(strDir.c_str(), "*", vFolders, false);
+
+    for (const std::string &strFolder : vFolders) {
+      if (stOptions.OwnsShard(strFolder))
+        WalkFiles(strFolder.c_str(), p_cPattern, clVisit, true);
+    }
+  };
+
+  for (const std::string &strPath : vPaths) {
+    if (strpbrk(strPath.c_str(), "?*") != nullptr) {
+      // DOS wildcard pattern
+      WalkShard(DirName(strPath), BaseName(strPath).c_str());
+    }
+    else if (IsFolder(strPath)) {
+      // Directory
+      WalkShard(strPath, "*");
+    }
+    else if (stOptions.OwnsShard(DirName(strPath))) {
+      // Individual file
+      clVisit(strPath);
+    }
+  }
+
+  // Listed paths go straight to the queue (no searching or wildcard expansion)
+  bool bSuccess = true;
+
+  if (!stOptions.strListFile.empty()) {
+    bSuccess = ReadFileList(stOptions.strListFile, stOptions.cListDelimiter, [&](const std::string &strFile) -> bool {
+      return !stOptions.OwnsShard(DirName(strFile)) || clVisit(strFile);
+    });
+  }
+
+  clPool.Wait();
+
+  clSession.PrintSummary();
+
+  const int iExitCode = clSession.Close();
+
+  std::cout << "Done." << std::endl;
+
+  return bSuccess ? iExitCode : std::max(iExitCode, 1);
 }
 
+#ifdef __linux__
 
-bool GetCSAHeaderFromElement(const itk::MetaDataDictionary &clDicomTags, const std::string &strKey, gdcm::CSAHeader &clCSAHeader) {
-  uint16_t ui16Group = 0, ui16Element = 0;
+namespace {
 
-  clCSAHeader = gdcm::CSAHeader();
+volatile sig_atomic_t g_bStop = 0;
+volatile sig_atomic_t g_bPrintStats = 0;
 
-  if (!ParseITKTag(strKey, ui16Group, ui16Element))
-    return false;
+void HandleStopSignal(int) { g_bStop = 1; }
+void HandleStatsSignal(int) { g_bPrintStats = 1; }
 
-  std::string strValue;
+} // end anonymous namespace
 
-  if (!itk::ExposeMetaData<std::string>(clDicomTags, strKey, strValue))
-    return false;
+int RunDaemon(const std::vector<std::string> &vFolders, const Options &stOptions) {
+  typedef FolderWatcher::ClockType ClockType;
 
-  const int iDecodeLength = gdcm::Base64::GetDecodeLength(strValue.c_str(), (int)strValue.size());
+  FolderWatcher clWatcher;
 
-  if (iDecodeLength <= 0)
-    return false;
+  if (!clWatcher.Good())
+    return 1;
 
-  std::vector<char> vBuffer(iDecodeLength);
+  for (const std::string &strFolder : vFolders) {
+    if (!IsFolder(strFolder)) {
+      std::cerr << "Error: '" << strFolder << "' is not a folder." << std::endl;
+      return 1;
+    }
 
-  if (gdcm::Base64::Decode(&vBuffer[0], vBuffer.size(), strValue.c_str(), strValue.size()) == 0)
-    return false;
+    if (!clWatcher.AddFolder(strFolder, stOptions.bRecursive))
+      return 1;
+
+    std::cout << "Info: Watching '" << strFolder << "' ..." << std::endl;
+  }
+
+  // Milliseconds from the first inotify event to the file being standardized
+  std::atomic<uint64_t> ui64NumDone(0), ui64TotalLatency(0), ui64MaxLatency(0);
+
+  std::signal(SIGINT, &HandleStopSignal);
+  std::signal(SIGTERM, &HandleStopSignal);
+  std::signal(SIGUSR1, &HandleStatsSignal);
+
+  Session clSession(stOptions);
+
+  if (!clSession.Open())
+    return 1;
+
+  // One job per path at a time. A path dispatched again while it is being standardized runs once more afterwards.
+  struct JobType {
+    FolderWatcher::GenerationType stGeneration; // The version being standardized
+    bool bRequeue;
+    ClockType::time_point clRequeueEvent;
+  };
+
+  std::mutex clJobMutex;
+  std::unordered_map<std::string, JobType> mapJobs;
+
+  clSession.SetReplaceCallback([&](const std::string &strFile, const std::string &strNewPath) -> bool {
+    // Written to since it was read? Then the rewrite would lose that write.
+    FolderWatcher::GenerationType stGeneration = FolderWatcher::GenerationType();
+    FolderWatcher::GetGeneration(strFile, stGeneration);
+
+    {
+      std::unique_lock<std::mutex> clLock(clJobMutex);
+
+      auto itr = mapJobs.find(strFile);
+
+      if (itr != mapJobs.end() && !(itr->second.stGeneration == stGeneration)) {
+        std::cerr << "Warning: '" << strFile << "' changed while being standardized. Keeping it to standardize again." << std::endl;
+
+        if (!itr->second.bRequeue) {
+          itr->second.bRequeue = true;
+          itr->second.clRequeueEvent = ClockType::now();
+        }
+
+        return false;
+      }
+    }
+
+    // Known before the rewrite lands, so its own events are never dispatched
+    clWatcher.MarkProcessed(strFile, strNewPath);
+    return true;
+  });
+
+  WorkerPool clPool(stOptions.uiNumThreads);
+
+  auto PrintStats = [&]() {
+    const uint64_t ui64Count = ui64NumDone;
+
+    std::cout << "Info: Queue depth = " << clPool.GetQueueDepth() << " (" << clWatcher.GetNumPending() << " settling)" <<
+      ", done = " << ui64Count <<
+      ", mean latency = " << (ui64Count > 0 ? ui64TotalLatency / ui64Count : 0) << " ms" <<
+      ", max latency = " << ui64MaxLatency << " ms" <<
+      ", concurrency = " << clSession.GetConcurrency() << std::endl;
+
+    clSession.PrintSummary();
+  };
+
+  // Export rows would otherwise only be written as the buffers fill up or when stopping
+  ClockType::time_point clLastFlush = ClockType::now();
+
+  clWatcher.SetTickCallback([&]() {
+    if (g_bPrintStats) {
+      g_bPrintStats = 0;
+      PrintStats();
+    }
+
+    const ClockType::time_point clNow = ClockType::now();
+
+    if (clNow - clLastFlush > std::chrono::seconds(5)) {
+      if (!clSession.FlushExport())
+        std::cerr << "Error: Failed to write export file '" << stOptions.strExportFile << "'." << std::endl;
+
+      clLastFlush = clNow;
+    }
+  });
+
+  clWatcher.Run([&](const std::string &strFile, const ClockType::time_point &clFirstEvent) {
+    {
+      std::unique_lock<std::mutex> clLock(clJobMutex);
+
+      auto itr = mapJobs.find(strFile);
+
+      if (itr != mapJobs.end()) {
+        if (!itr->second.bRequeue) {
+          itr->second.bRequeue = true;
+          itr->second.clRequeueEvent = clFirstEvent;
+        }
 
-  gdcm::DataElement clDataElement;
-  clDataElement.SetTag(gdcm::Tag(ui16Group, ui16Element));
-  clDataElement.SetByteValue(&vBuffer[0], vBuffer.size());
+        return;
+      }
 
-  return clCSAHeader.LoadFromDataElement(clDataElement);
+      JobType &stJob = mapJobs[strFile];
+      stJob.bRequeue = false;
+      stJob.clRequeueEvent = clFirstEvent;
+    }
+
+    clPool.Push([&, strFile, clFirstEvent]() {
+      ClockType::time_point clEvent = clFirstEvent;
+
+      while (true) {
+        FolderWatcher::GenerationType stGeneration = FolderWatcher::GenerationType();
+        FolderWatcher::GetGeneration(strFile, stGeneration);
+
+        {
+          std::unique_lock<std::mutex> clLock(clJobMutex);
+          mapJobs[strFile].stGeneration = stGeneration;
+        }
+
+        clSession.ProcessFile(strFile);
+
+        const uint64_t ui64Latency = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(ClockType::now() - clEvent).count();
+        ui64TotalLatency += ui64Latency;
+        ++ui64NumDone;
+
+        uint64_t ui64Max = ui64MaxLatency;
+        while (ui64Latency > ui64Max && !ui64MaxLatency.compare_exchange_weak(ui64Max, ui64Latency)) { }
+
+        std::unique_lock<std::mutex> clLock(clJobMutex);
+
+        auto itr = mapJobs.find(strFile);
+
+        if (!itr->second.bRequeue || g_bStop) {
+          mapJobs.erase(itr);
+          break;
+        }
+
+        itr->second.bRequeue = false;
+        clEvent = itr->second.clRequeueEvent;
+      }
+    });
+  }, g_bStop);
+
+  std::cout << "Info: Stopping. Waiting for queued files to finish ..." << std::endl;
+
+  clPool.Wait();
+
+  PrintStats();
+
+  const int iExitCode = clSession.Close();
+
+  std::cout << "Done." << std::endl;
+
+  return iExitCode;
 }
 
-std::string ComputeDiffusionBValue(const itk::MetaDataDictionary &clDicomTags) {
+#endif // __linux__
+
+std::string ComputeDiffusionBValue(const itk::MetaDataDictionary &clDicomTags, std::string *p_strResolver) {
   std::string strBValue;
+  std::string strResolver;
+
+  if (p_strResolver == nullptr)
+    p_strResolver = &strResolver;
+
+  // Only named once a b-value was actually found
+  p_strResolver->clear();
 
   if (itk::ExposeMetaData(clDicomTags, "0018|9087", strBValue)) {
     Trim(strBValue);
+
+    if (strBValue.size() > 0)
+      *p_strResolver = "standard";
+
     return strBValue;
   }
 
@@ -269,8 +1134,14 @@ std::string ComputeDiffusionBValue(const itk::MetaDataDictionary &clDicomTags) {
   itk::ExposeMetaData(clDicomTags, "0010|0010", strPatientName);
   itk::ExposeMetaData(clDicomTags, "0010|0020", strPatientId);
 
-  if (strcasestr(strPatientName.c_str(), "prostatex") != nullptr || strcasestr(strPatientId.c_str(), "prostatex") != nullptr)
-    return ComputeDiffusionBValueProstateX(clDicomTags);
+  if (strcasestr(strPatientName.c_str(), "prostatex") != nullptr || strcasestr(strPatientId.c_str(), "prostatex") != nullptr) {
+    strBValue = ComputeDiffusionBValueProstateX(clDicomTags);
+
+    if (strBValue.size() > 0)
+      *p_strResolver = "prostatex";
+
+    return strBValue;
+  }
 
   if (!itk::ExposeMetaData(clDicomTags, "0008|0070", strManufacturer)) {
     std::cerr << "Error: Could not determine manufacturer." << std::endl;
@@ -278,73 +1149,111 @@ std::string ComputeDiffusionBValue(const itk::MetaDataDictionary &clDicomTags) {
   }
 
   if (strcasestr(strManufacturer.c_str(), "siemens") != nullptr)
-    return ComputeDiffusionBValueSiemens(clDicomTags);
-  else if (strcasestr(strManufacturer.c_str(), "ge") != nullptr)
-    return ComputeDiffusionBValueGE(clDicomTags);
-  else if (strcasestr(strManufacturer.c_str(), "philips") != nullptr)
-    return ComputeDiffusionBValuePhilips(clDicomTags);
+    return ComputeDiffusionBValueSiemens(clDicomTags, p_strResolver);
+
+  if (strcasestr(strManufacturer.c_str(), "ge") != nullptr) {
+    strBValue = ComputeDiffusionBValueGE(clDicomTags);
+
+    if (strBValue.size() > 0)
+      *p_strResolver = "ge";
+
+    return strBValue;
+  }
+
+  if (strcasestr(strManufacturer.c_str(), "philips") != nullptr) {
+    strBValue = ComputeDiffusionBValuePhilips(clDicomTags);
+
+    if (strBValue.size() > 0)
+      *p_strResolver = "philips";
+
+    return strBValue;
+  }
 
   return std::string();
 }
 
-std::string ComputeDiffusionBValueSiemens(const itk::MetaDataDictionary &clDicomTags) {
+std::string ComputeDiffusionBValueSiemens(const itk::MetaDataDictionary &clDicomTags, std::string *p_strResolver) {
+  std::string strResolver;
+
+  if (p_strResolver == nullptr)
+    p_strResolver = &strResolver;
+
+  p_strResolver->clear();
+
   std::string strModel;
+  std::string strSequenceName;
+  std::string strBValue;
 
-  if (itk::ExposeMetaData(clDicomTags, "0008|1090", strModel)) {
-    if ((strcasestr(strModel.c_str(), "skyra") != nullptr || strcasestr(strModel.c_str(), "verio") != nullptr)) {
-      std::string strTmp = ComputeDiffusionBValueProstateX(clDicomTags);
+  itk::ExposeMetaData(clDicomTags, "0008|1090", strModel);
+  itk::ExposeMetaData(clDicomTags, "0018|0024", strSequenceName);
 
-      if (strTmp.size() > 0)
-        return strTmp;
-    }
+  Trim(strSequenceName);
+
+  // Cheapest first and CSA decoding last. Skyra and Verio sequence names are trusted over everything else (e.g. ProstateX).
+  const bool bPreferSequenceName = strcasestr(strModel.c_str(), "skyra") != nullptr || strcasestr(strModel.c_str(), "verio") != nullptr;
+
+  if (bPreferSequenceName && ParseSequenceNameBValue(strSequenceName, strBValue)) {
+    *p_strResolver = "siemens_sequence_name";
+    return strBValue;
   }
 
-  gdcm::CSAHeader clCSAHeader;
+  // (0019,100C) B_value of the SIEMENS MR HEADER private block
+  std::string strCreator;
+  std::string strValue;
 
-  if (!GetCSAHeaderFromElement(clDicomTags, "0029|1010", clCSAHeader)) // Nothing to do
-    return std::string();
+  if (itk::ExposeMetaData(clDicomTags, "0019|0010", strCreator) && strcasestr(strCreator.c_str(), "SIEMENS MR HEADER") != nullptr &&
+    itk::ExposeMetaData(clDicomTags, "0019|100c", strValue) && NormalizeBValue(strValue, strBValue)) {
+    *p_strResolver = "siemens_private";
+    return strBValue;
+  }
 
+  if (!bPreferSequenceName && ParseSequenceNameBValue(strSequenceName, strBValue)) {
+    *p_strResolver = "siemens_sequence_name";
+    return strBValue;
+  }
+
+  // Finding only the B_value element steps over the others, which is much cheaper than decoding the whole header.
+  // CSA1 headers (and anything FindCSAElementBytes() does not trust) are still decoded by gdcm.
+  std::string strCSAElement;
   std::string strTmp;
 
-  if (ExposeCSAMetaData(clCSAHeader, "B_value", strTmp))
-    return strTmp;
+  if (FindCSAElementBytes(clDicomTags, "0029|1010", "B_value", strCSAElement)) {
+    // A corrupt header can hold anything
+    if (!GetCSAElementString(strCSAElement, strTmp) || !NormalizeBValue(strTmp, strBValue))
+      strBValue.clear();
+  }
+  else {
+    gdcm::CSAHeader clCSAHeader;
 
-  return std::string();
+    if (!GetCSAHeaderFromElement(clDicomTags, "0029|1010", clCSAHeader) || !ExposeCSAMetaData(clCSAHeader, "B_value", strTmp) || !NormalizeBValue(strTmp, strBValue))
+      strBValue.clear();
+  }
+
+  if (strBValue.size() > 0)
+    *p_strResolver = "siemens_csa";
+
+  return strBValue;
 }
 
 std::string ComputeDiffusionBValueGE(const itk::MetaDataDictionary &clDicomTags) {
   std::string strValue;
-  if (!itk::ExposeMetaData(clDicomTags, "0043|1039", strValue))
-    return std::string(); // Nothing to do
-
-  size_t p = strValue.find('\\');
-  if (p == std::string::npos)
-    return std::string(); // Not sure what to do
-
-  strValue.erase(p);
-
-  std::stringstream valueStream;
-  valueStream.str(strValue);
-
-  double dValue = 0.0;
+  std::string strBValue;
 
-  if (!(valueStream >> dValue) || dValue < 0.0) // Bogus value
+  // Slop_int_6 ... 9, the first is the b-value
+  if (!ExposePrivateMetaData(clDicomTags, "0043|1039", "0043|0010", "GEMS_PARM_01", strValue) || !ParseGEBValue(strValue, strBValue))
     return std::string();
 
-  // Something is screwed up here ... let's try to remove the largest significant digit
-  if (dValue > 4000.0) {
-    p = strValue.find_first_not_of(" \t0");
-
-    strValue.erase(strValue.begin(), strValue.begin()+p+1);
+  return strBValue;
+}
 
-    valueStream.clear();
-    valueStream.str(strValue);
+bool ExposePrivateMetaData(const itk::MetaDataDictionary &clDicomTags, const char *p_cKey, const char *p_cCreatorKey, const char *p_cCreator, std::string &strValue) {
+  if (!itk::ExposeMetaData(clDicomTags, p_cKey, strValue))
+    return false;
 
-    if (!(valueStream >> dValue) || dValue < 0.0 || dValue > 4000.0)
-      return std::string();
-  }
+  // Private elements only mean something in their creator's block (tolerate a missing creator like before)
+  std::string strCreator;
 
-  return std::to_string((long long)dValue);
+  return !itk::ExposeMetaData(clDicomTags, p_cCreatorKey, strCreator) || strcasestr(strCreator.c_str(), p_cCreator) != nullptr;
 }
 
 std::string ComputeDiffusionBValueProstateX(const itk::MetaDataDictionary &clDicomTags) {
@@ -361,184 +1270,455 @@ std::string ComputeDiffusionBValueProstateX(const itk::MetaDataDictionary &clDic
     return std::string();
   }
 
-  std::stringstream valueStream;
+  std::string strBValue;
 
-  unsigned int uiBValue = 0;
+  if (!ParseSequenceNameBValue(strSequenceName, strBValue)) {
+    std::cerr << "Error: Could not parse sequence name '" << strSequenceName << "'." << std::endl;
+    return std::string();
+  }
 
-  size_t i = 0, j = 0;
-  while (i < strSequenceName.size()) {
-    i = strSequenceName.find('b', i); 
+  return strBValue;
+}
 
-    if (i == std::string::npos || ++i >= strSequenceName.size())
-      break;
+std::string ComputeDiffusionBValuePhilips(const itk::MetaDataDictionary &clDicomTags) {
+  std::string strValue;
+  std::string strBValue;
 
-    j = strSequenceName.find_first_not_of("0123456789", i); 
+  // Diffusion B-Factor (FL)
+  if (!ExposePrivateMetaData(clDicomTags, "2001|1003", "2001|0010", "Philips Imaging DD 001", strValue) || !ParsePhilipsBValue(strValue, strBValue))
+    return std::string();
 
-    // Should end with a 't' or a '\0'
-    if (j == std::string::npos)
-      j = strSequenceName.size();
-    else if (strSequenceName[j] != 't')
-      break;
+  return strBValue;
+}
+
+int ComputeDiffusionScore(const std::string &strFolder, const std::string &strFile) {
+  static const char * const a_cKeywords[] = { "diff", "dwi", "dti", "ep2d", "resolve" };
 
-    if (j > i) {
-      std::string strBValue = strSequenceName.substr(i, j-i);
-      valueStream.clear();
-      valueStream.str(strBValue);
+  const std::string strFolderName = BaseName(strFolder);
+
+  // Cheapest first: the folder name alone is often enough
+  for (const char *p_cKeyword : a_cKeywords) {
+    if (strcasestr(strFolderName.c_str(), p_cKeyword) != nullptr)
+      return 4;
+  }
 
-      uiBValue = 0;
+  const gdcm::Tag clImageTypeTag(0x0008, 0x0008);
+  const gdcm::Tag clSeriesDescriptionTag(0x0008, 0x103e);
+  const gdcm::Tag clSequenceNameTag(0x0018, 0x0024);
 
-      if (valueStream >> uiBValue) {
-        if (uiBValue < 4000)
-          return strBValue;
-        else
-          std::cerr << "Error: B-value of " << uiBValue << " seems bogus. Continuing to parse." << std::endl;
-      }   
-    }   
+  std::set<gdcm::Tag> sTags;
+  sTags.insert(clImageTypeTag);
+  sTags.insert(clSeriesDescriptionTag);
+  sTags.insert(clSequenceNameTag);
 
-    i = j;
+  // Stops parsing after (0018,0024)
+  gdcm::Reader clReader;
+  clReader.SetFileName(strFile.c_str());
+
+  if (!clReader.ReadSelectedTags(sTags))
+    return 0;
+
+  const gdcm::DataSet &clDataSet = clReader.GetFile().GetDataSet();
+
+  gdcm::StringFilter clFilter;
+  clFilter.SetFile(clReader.GetFile());
+
+  int iScore = 0;
+
+  if (clDataSet.FindDataElement(clSequenceNameTag)) {
+    const std::string strSequenceName = clFilter.ToString(clSequenceNameTag);
+
+    // Siemens diffusion sequences look like *ep_b800t
+    if (strcasestr(strSequenceName.c_str(), "ep_b") != nullptr || strcasestr(strSequenceName.c_str(), "diff") != nullptr)
+      iScore += 3;
   }
 
-  std::cerr << "Error: Could not parse sequence name '" << strSequenceName << "'." << std::endl;
+  if (clDataSet.FindDataElement(clImageTypeTag)) {
+    const std::string strImageType = clFilter.ToString(clImageTypeTag);
 
-  return std::string();
+    if (strcasestr(strImageType.c_str(), "diffusion") != nullptr)
+      iScore += 3;
+  }
+
+  if (clDataSet.FindDataElement(clSeriesDescriptionTag)) {
+    const std::string strSeriesDescription = clFilter.ToString(clSeriesDescriptionTag);
+
+    for (const char *p_cKeyword : a_cKeywords) {
+      if (strcasestr(strSeriesDescription.c_str(), p_cKeyword) != nullptr) {
+        iScore += 1;
+        break;
+      }
+    }
+  }
+
+  return iScore;
 }
 
-std::string ComputeDiffusionBValuePhilips(const itk::MetaDataDictionary &clDicomTags) {
+void PrioritizeFiles(std::vector<std::string> &vFiles) {
+  struct FileInfo {
+    size_t szFolderIndex;
+    uint64_t ui64Size;
+    std::string strPath;
+  };
+
+  std::unordered_map<std::string, size_t> mapFolderIndex;
+  std::vector<int> vFolderScores;
+  std::vector<FileInfo> vFileInfos;
+
+  vFileInfos.reserve(vFiles.size());
+
+  for (std::string &strFile : vFiles) {
+    const std::string strFolder = DirName(strFile);
+
+    auto itr = mapFolderIndex.find(strFolder);
+
+    if (itr == mapFolderIndex.end()) {
+      // Score a folder by its first file
+      itr = mapFolderIndex.emplace(strFolder, vFolderScores.size()).first;
+      vFolderScores.push_back(ComputeDiffusionScore(strFolder, strFile));
+    }
+
+    FileInfo stFile;
+    stFile.szFolderIndex = itr->second;
+    stFile.ui64Size = FileSize(strFile);
+    stFile.strPath = std::move(strFile);
+
+    vFileInfos.push_back(std::move(stFile));
+  }
+
+  std::stable_sort(vFileInfos.begin(), vFileInfos.end(), 
+    [&vFolderScores](const FileInfo &a, const FileInfo &b) -> bool {
+      if (a.szFolderIndex == b.szFolderIndex)
+        return a.ui64Size < b.ui64Size;
+
+      const int iScoreA = vFolderScores[a.szFolderIndex];
+      const int iScoreB = vFolderScores[b.szFolderIndex];
+
+      return iScoreA != iScoreB ? iScoreA > iScoreB : a.szFolderIndex < b.szFolderIndex;
+    });
+
+  for (size_t i = 0; i < vFileInfos.size(); ++i)
+    vFiles[i] = std::move(vFileInfos[i].strPath);
+}
+
+size_t RemoveDuplicateFiles(std::vector<std::string> &vFiles) {
+  struct FileEntry {
+    FileId stId;
+    size_t szIndex;
+  };
+
+  // A sorted vector stays compact for millions of files
+  std::vector<FileEntry> vEntries;
+  vEntries.reserve(vFiles.size());
+
+  for (size_t i = 0; i < vFiles.size(); ++i) {
+    FileEntry stEntry;
+    stEntry.szIndex = i;
+
+    if (GetFileId(vFiles[i], stEntry.stId)) // Otherwise let StandardizeBValue() report it
+      vEntries.push_back(stEntry);
+  }
+
+  std::sort(vEntries.begin(), vEntries.end(),
+    [](const FileEntry &a, const FileEntry &b) -> bool {
+      return a.stId != b.stId ? a.stId < b.stId : a.szIndex < b.szIndex;
+    });
+
+  std::vector<bool> vKeep(vFiles.size(), true);
+  size_t szNumDuplicates = 0;
+
+  size_t szFirst = 0;
+
+  for (size_t i = 1; i < vEntries.size(); ++i) {
+    if (vEntries[i].stId != vEntries[szFirst].stId) {
+      szFirst = i;
+      continue;
+    }
+
+    std::cout << "Info: '" << vFiles[vEntries[i].szIndex] << "' is the same file as '" << vFiles[vEntries[szFirst].szIndex] << "'." << std::endl;
+
+    vKeep[vEntries[i].szIndex] = false;
+    ++szNumDuplicates;
+  }
+
+  if (szNumDuplicates == 0)
+    return 0;
+
+  size_t szNewSize = 0;
+
+  for (size_t i = 0; i < vFiles.size(); ++i) {
+    if (vKeep[i]) {
+      if (szNewSize != i)
+        vFiles[szNewSize] = std::move(vFiles[i]);
+
+      ++szNewSize;
+    }
+  }
+
+  vFiles.resize(szNewSize);
+
+  return szNumDuplicates;
+}
+
+bool PrefilterDicomFile(const std::string &strFileName, OutcomeType &eOutcome, ExportRow *p_stRow) {
+  const gdcm::Tag clModalityTag(0x0008, 0x0060);
+  const gdcm::Tag clManufacturerTag(0x0008, 0x0070);
+  const gdcm::Tag clSequenceNameTag(0x0018, 0x0024);
+  const gdcm::Tag clBValueTag(0x0018, 0x9087);
+  const gdcm::Tag clSeriesInstanceUIDTag(0x0020, 0x000e);
+  const gdcm::Tag clInstanceNumberTag(0x0020, 0x0013);
+  const gdcm::Tag clSharedGroupsTag(0x5200, 0x9229);
+  const gdcm::Tag clPerFrameGroupsTag(0x5200, 0x9230);
+
+  std::set<gdcm::Tag> sTags;
+  sTags.insert(clModalityTag);
+  sTags.insert(clBValueTag);
+  sTags.insert(clSharedGroupsTag);
+  sTags.insert(clPerFrameGroupsTag);
+
+  if (p_stRow != nullptr) {
+    sTags.insert(clManufacturerTag);
+    sTags.insert(clSequenceNameTag);
+    sTags.insert(clSeriesInstanceUIDTag);
+    sTags.insert(clInstanceNumberTag);
+  }
+
+  gdcm::Reader clReader;
+  clReader.SetFileName(strFileName.c_str());
+
+  bool bRead = false;
+
+  {
+    IOTimer clTimer; // gdcm reads the file itself, so parsing counts as well
+    bRead = clReader.ReadSelectedTags(sTags);
+  }
+
+  if (!bRead)
+    return true; // Let ITK report it
+
+  const gdcm::DataSet &clDataSet = clReader.GetFile().GetDataSet();
+
+  gdcm::StringFilter clFilter;
+  clFilter.SetFile(clReader.GetFile());
+
+  auto GetString = [&clDataSet, &clFilter](const gdcm::Tag &clTag) -> std::string {
+    std::string strValue;
+
+    if (clDataSet.FindDataElement(clTag)) {
+      strValue = clFilter.ToString(clTag);
+      Trim(strValue);
+    }
+
+    return strValue;
+  };
+
+  if (p_stRow != nullptr) {
+    p_stRow->strSeriesInstanceUID = GetString(clSeriesInstanceUIDTag);
+    p_stRow->strInstanceNumber = GetString(clInstanceNumberTag);
+    p_stRow->strManufacturer = GetString(clManufacturerTag);
+    p_stRow->strSequenceName = GetString(clSequenceNameTag);
+  }
+
+  const std::string strModality = GetString(clModalityTag);
+
+  if (strModality.empty()) {
+    std::cerr << "Error: Could not determine image modality." << std::endl;
+    eOutcome = OUTCOME_NOT_MR;
+    return false;
+  }
+
+  if (strModality != "MR") {
+    std::cerr << "Error: Incorrect imaging modality (" << strModality << " != MR)." << std::endl;
+    eOutcome = OUTCOME_NOT_MR;
+    return false;
+  }
+
+  if (clDataSet.FindDataElement(clBValueTag)) {
+    const std::string strBValue = GetString(clBValueTag);
+
+    std::cerr << "Error: Diffusion b-value is already standardized (b = " << strBValue << ")." << std::endl;
+
+    if (p_stRow != nullptr) {
+      p_stRow->strBValue = strBValue;
+      p_stRow->strResolver = "standard";
+    }
+
+    eOutcome = OUTCOME_ALREADY_STANDARDIZED;
+    return false;
+  }
+
+  // Enhanced files keep it per frame (or once for all frames), which is just as standard
   std::string strBValue;
 
-  if (!itk::ExposeMetaData(clDicomTags, "2001|1003", strBValue))
-    return std::string();
+  if (FindFunctionalGroupBValue(clDataSet, strBValue)) {
+    std::cerr << "Error: Diffusion b-value is already standardized in the functional groups (b = " << (strBValue.empty() ? "varies" : strBValue) << ")." << std::endl;
 
-  return strBValue;
+    if (p_stRow != nullptr) {
+      p_stRow->strBValue = strBValue;
+      p_stRow->strResolver = "standard_functional_group";
+    }
+
+    eOutcome = OUTCOME_ALREADY_STANDARDIZED;
+    return false;
+  }
+
+  return true;
 }
 
-bool StandardizeBValue(const std::string &strFileName) {
+OutcomeType StandardizeBValue(const std::string &strFileName, const Options &stOptions, ExportRow *p_stRow, const ReplaceCallbackType &clReplace) {
   typedef itk::GDCMImageIO ImageIOType;
 
-  ImageIOType::Pointer p_clImageIO = ImageIOType::New();
-
-  if (!p_clImageIO->CanReadFile(strFileName.c_str())) {
+  if (!IsDicomFile(strFileName)) {
     std::cerr << "Error: Could not read '" << strFileName << "' (not a DICOM?)." << std::endl;
-    return false;
+    return OUTCOME_NOT_DICOM;
   }
 
+  OutcomeType eOutcome = OUTCOME_STANDARDIZED;
+
+  // Files with nothing to do never need ITK
+  if (!PrefilterDicomFile(strFileName, eOutcome, p_stRow))
+    return eOutcome;
+
+  ImageIOType::Pointer p_clImageIO = ImageIOType::New();
+
   p_clImageIO->SetFileName(strFileName);
   p_clImageIO->KeepOriginalUIDOn();
   p_clImageIO->LoadPrivateTagsOn();
 
   try {
+    IOTimer clTimer; // ITK reads the file itself
     p_clImageIO->ReadImageInformation();
   }
   catch (itk::ExceptionObject &e) {
     std::cerr << "Error: " << e << std::endl;
-    return false;
+    return OUTCOME_READ_FAILED;
   }
 
   const itk::MetaDataDictionary &clDicomTags = p_clImageIO->GetMetaDataDictionary();
 
+  if (p_stRow != nullptr) {
+    itk::ExposeMetaData(clDicomTags, "0020|000e", p_stRow->strSeriesInstanceUID);
+    itk::ExposeMetaData(clDicomTags, "0020|0013", p_stRow->strInstanceNumber);
+    itk::ExposeMetaData(clDicomTags, "0008|0070", p_stRow->strManufacturer);
+    itk::ExposeMetaData(clDicomTags, "0018|0024", p_stRow->strSequenceName);
+
+    Trim(p_stRow->strSeriesInstanceUID);
+    Trim(p_stRow->strInstanceNumber);
+    Trim(p_stRow->strManufacturer);
+    Trim(p_stRow->strSequenceName);
+  }
+
   std::string strModality;
   if (!itk::ExposeMetaData(clDicomTags, "0008|0060", strModality)) {
     std::cerr << "Error: Could not determine image modality." << std::endl;
-    return false;
+    return OUTCOME_NOT_MR;
   }
 
   Trim(strModality);
 
   if (strModality != "MR") {
     std::cerr << "Error: Incorrect imaging modality (" << strModality << " != MR)." << std::endl;
-    return false;
+    return OUTCOME_NOT_MR;
   }
 
   std::string strBValue;
   if (itk::ExposeMetaData(clDicomTags, "0018|9087", strBValue)) {
     Trim(strBValue);
     std::cerr << "Error: Diffusion b-value is already standardized (b = " << strBValue << ")." << std::endl;
-    return true;
+
+    if (p_stRow != nullptr) {
+      p_stRow->strBValue = strBValue;
+      p_stRow->strResolver = "standard";
+    }
+
+    return OUTCOME_ALREADY_STANDARDIZED;
+  }
+
+  std::string strResolver;
+  strBValue = ComputeDiffusionBValue(clDicomTags, &strResolver);
+
+  if (p_stRow != nullptr) {
+    p_stRow->strBValue = strBValue;
+    p_stRow->strResolver = strResolver;
   }
 
-  // Support possibly weird images?
+  if (strBValue.empty()) {
+    std::cerr << "Error: Could not determine diffusion b-value (not a diffusion scan?)." << std::endl;
+    return OUTCOME_NO_BVALUE;
+  }
+
+  std::cout << "Info: Diffusion b-value = " << strBValue << std::endl;
+
+  if (stOptions.bDryRun) {
+    std::cout << "Info: Dry run, not saving '" << strFileName << "'." << std::endl;
+    return OUTCOME_STANDARDIZED;
+  }
+
+  itk::MetaDataDictionary clNewTags;
+  itk::EncapsulateMetaData(clNewTags, "0018|9087", strBValue);
+
+  // With -V the new file is read back before it replaces the original
+  bool bVerifyFailed = false;
+  VerifyCallbackType clVerify;
+
+  if (stOptions.bVerify || clReplace) {
+    const bool bVerify = stOptions.bVerify;
+    const double dBValue = strtod(strBValue.c_str(), nullptr);
+
+    clVerify = [&bVerifyFailed, &strFileName, &clReplace, bVerify, dBValue](const std::string &strNewPath, const gdcm::DataSet &clDataSet) -> bool {
+      // Pixel Data is only hashed when it is checked
+      bVerifyFailed = bVerify && !VerifyDicomFile(strNewPath, dBValue, HashDicomPixelData(clDataSet));
+
+      if (bVerifyFailed)
+        return false;
+
+      return !clReplace || clReplace(strFileName, strNewPath);
+    };
+  }
+
+  if (!stOptions.bDecompress) {
+    // Only add (0018,9087). Pixel Data is never decoded.
+    std::cout << "Info: Saving standardized image to '" << strFileName << "' ..." << std::endl;
+
+    if (!SaveDicomTags(strFileName, clNewTags, clVerify)) {
+      std::cerr << "Error: Failed to save image." << std::endl;
+      return bVerifyFailed ? OUTCOME_VERIFY_FAILED : OUTCOME_WRITE_FAILED;
+    }
+
+    return OUTCOME_STANDARDIZED;
+  }
+
+  // Decoded samples are handled by component type alone (see DicomComponentTypes)
   switch (p_clImageIO->GetPixelType()) {
   case ImageIOType::SCALAR:
-    switch (p_clImageIO->GetInternalComponentType()) {
-    case ImageIOType::UCHAR:
-      return StandardizeBValueHelper<unsigned char>(strFileName);
-    case ImageIOType::CHAR:
-      return StandardizeBValueHelper<char>(strFileName);
-    case ImageIOType::USHORT:
-      return StandardizeBValueHelper<unsigned short>(strFileName);
-    case ImageIOType::SHORT:
-      return StandardizeBValueHelper<short>(strFileName);
-    case ImageIOType::UINT:
-      return StandardizeBValueHelper<unsigned int>(strFileName);
-    case ImageIOType::INT:
-      return StandardizeBValueHelper<int>(strFileName);
-    case ImageIOType::FLOAT:
-      return StandardizeBValueHelper<float>(strFileName);
-    case ImageIOType::DOUBLE:
-      return StandardizeBValueHelper<double>(strFileName);
-    default:
-      std::cerr << "Error: Unknown scalar component type." << std::endl;
-      return false;
-    }
-    break;
   case ImageIOType::RGB:
-    switch (p_clImageIO->GetInternalComponentType()) {
-    case ImageIOType::UCHAR:
-      return StandardizeBValueHelper<itk::RGBPixel<unsigned char>>(strFileName);
-    default:
-      std::cerr << "Error: Unknown RGB component type." << std::endl;
-      return false;
-    }
-    break;
   case ImageIOType::RGBA:
-    switch (p_clImageIO->GetInternalComponentType()) {
-    case ImageIOType::UCHAR:
-      return StandardizeBValueHelper<itk::RGBAPixel<unsigned char>>(strFileName);
-    default:
-      std::cerr << "Error: Unknown RGBA component type." << std::endl;
-      return false;
-    }
     break;
   default:
     std::cerr << "Error: Unknown pixel type." << std::endl;
-    return false;
+    return OUTCOME_UNSUPPORTED;
   }
 
-  return false; // Not reached
-}
-
-template<typename PixelType>
-bool StandardizeBValueHelper(const std::string &strFileName) {
-  typedef itk::Image<PixelType, 2> ImageType;
-
-  typename ImageType::Pointer p_clSlice = LoadDicomImage<PixelType, 2>(strFileName);
+  const ImageIOType::IOComponentType eComponentType = p_clImageIO->GetComponentType();
 
-  if (!p_clSlice) {
-    std::cerr << "Error: Failed to load image slice." << std::endl;
-    return false;
+  if (!IsDicomComponentType(eComponentType)) {
+    std::cerr << "Error: Unknown component type." << std::endl;
+    return OUTCOME_UNSUPPORTED;
   }
 
-  itk::MetaDataDictionary clDicomTags = p_clSlice->GetMetaDataDictionary();
+  std::vector<char> vBuffer;
 
-  std::string strBValue = ComputeDiffusionBValue(clDicomTags);
-
-  if (strBValue.empty()) {
-    std::cerr << "Error: Could not determine diffusion b-value (not a diffusion scan?)." << std::endl;
-    return false;
+  if (!ReadDicomPixelData(p_clImageIO.GetPointer(), vBuffer)) {
+    std::cerr << "Error: Failed to load image slice." << std::endl;
+    return OUTCOME_READ_FAILED;
   }
 
-  std::cout << "Info: Diffusion b-value = " << strBValue << std::endl;
-
-  itk::EncapsulateMetaData(clDicomTags, "0018|9087", strBValue);
-
-  p_clSlice->SetMetaDataDictionary(clDicomTags);
-
   std::cout << "Info: Saving standardized image to '" << strFileName << "' ..." << std::endl;
 
-  if (!SaveDicomSlice<PixelType>(p_clSlice, strFileName)) {
+  if (!SaveDicomPixelData(strFileName, eComponentType, &vBuffer[0], p_clImageIO->GetImageSizeInComponents(), clNewTags, clVerify)) {
     std::cerr << "Error: Failed to save image." << std::endl;
-    return false;
+    return bVerifyFailed ? OUTCOME_VERIFY_FAILED : OUTCOME_WRITE_FAILED;
   }
 
-  return true;
+  return OUTCOME_STANDARDIZED;
 }
@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int uiNumThreads, size_t szMaxQueued)
+: m_szMaxQueued(szMaxQueued), m_szNumBusy(0), m_bStop(false) {
+  if (uiNumThreads == 0)
+    uiNumThreads = 1;
+
+  for (unsigned int i = 0; i < uiNumThreads; ++i)
+    m_vThreads.emplace_back(&WorkerPool::Run, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::unique_lock<std::mutex> clLock(m_clMutex);
+    m_bStop = true;
+  }
+
+  m_clTaskCondition.notify_all();
+
+  for (std::thread &clThread : m_vThreads)
+    clThread.join();
+}
+
+size_t WorkerPool::GetQueueDepth() const {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+  return m_dqTasks.size() + m_szNumBusy;
+}
+
+void WorkerPool::Push(const TaskType &clTask) {
+  {
+    std::unique_lock<std::mutex> clLock(m_clMutex);
+
+    while (m_szMaxQueued > 0 && m_dqTasks.size() >= m_szMaxQueued)
+      m_clSpaceCondition.wait(clLock);
+
+    m_dqTasks.push_back(clTask);
+  }
+
+  m_clTaskCondition.notify_one();
+}
+
+void WorkerPool::Wait() {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  while (m_dqTasks.size() > 0 || m_szNumBusy > 0)
+    m_clIdleCondition.wait(clLock);
+}
+
+void WorkerPool::Run() {
+  std::unique_lock<std::mutex> clLock(m_clMutex);
+
+  while (true) {
+    while (m_dqTasks.empty() && !m_bStop)
+      m_clTaskCondition.wait(clLock);
+
+    if (m_dqTasks.empty()) // Stopping and nothing left to do
+      break;
+
+    TaskType clTask = std::move(m_dqTasks.front());
+    m_dqTasks.pop_front();
+
+    ++m_szNumBusy;
+
+    if (m_szMaxQueued > 0)
+      m_clSpaceCondition.notify_one();
+
+    clLock.unlock();
+    clTask();
+    clLock.lock();
+
+    --m_szNumBusy;
+
+    if (m_dqTasks.empty() && m_szNumBusy == 0)
+      m_clIdleCondition.notify_all();
+  }
+}
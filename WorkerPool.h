@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+// Fixed number of threads pulling tasks off of a FIFO queue
+class WorkerPool {
+public:
+  typedef std::function<void()> TaskType;
+
+  // With szMaxQueued > 0, Push() blocks while that many tasks are waiting. Don't Push() from a task then.
+  explicit WorkerPool(unsigned int uiNumThreads = 1, size_t szMaxQueued = 0);
+
+  // Finishes all queued tasks before returning
+  ~WorkerPool();
+
+  unsigned int GetNumThreads() const { return (unsigned int)m_vThreads.size(); }
+
+  // Tasks waiting to run plus tasks running
+  size_t GetQueueDepth() const;
+
+  void Push(const TaskType &clTask);
+
+  // Block until the queue is empty and all workers are idle
+  void Wait();
+
+private:
+  std::vector<std::thread> m_vThreads;
+  std::deque<TaskType> m_dqTasks;
+
+  mutable std::mutex m_clMutex;
+  std::condition_variable m_clTaskCondition;
+  std::condition_variable m_clIdleCondition;
+  std::condition_variable m_clSpaceCondition;
+
+  size_t m_szMaxQueued;
+  size_t m_szNumBusy;
+  bool m_bStop;
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool & operator=(const WorkerPool &) = delete;
+
+  void Run();
+};
+
+#endif // !WORKERPOOL_H
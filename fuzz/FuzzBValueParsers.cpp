@@ -0,0 +1,56 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// libFuzzer target for the text b-value parsers: ParseSequenceNameBValue(), NormalizeBValue(),
+// ParseGEBValue() and ParsePhilipsBValue(). Any b-value they return must be a plain integer.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Common.h"
+
+namespace {
+
+void CheckBValue(bool bParsed, const std::string &strBValue) {
+  if (!bParsed)
+    return;
+
+  if (strBValue.empty() || strBValue.find_first_not_of("0123456789") != std::string::npos)
+    __builtin_trap();
+}
+
+} // end anonymous namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *p_ui8Data, size_t szSize) {
+  const std::string strValue((const char *)p_ui8Data, szSize);
+  std::string strBValue;
+
+  CheckBValue(ParseSequenceNameBValue(strValue, strBValue), strBValue);
+  CheckBValue(NormalizeBValue(strValue, strBValue), strBValue);
+  CheckBValue(ParseGEBValue(strValue, strBValue), strBValue);
+  CheckBValue(ParsePhilipsBValue(strValue, strBValue), strBValue);
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// libFuzzer target for FindCSAElementBytes(), GetCSAElementString(), GetCSAHeaderFromElement() and ExposeCSAMetaData().
+// The input is the raw (0029,1010) value, handed over base64-encoded like ITK keeps it for a private binary element.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Common.h"
+
+#include "itkMetaDataDictionary.h"
+#include "itkMetaDataObject.h"
+
+#include "gdcmBase64.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *p_ui8Data, size_t szSize) {
+  if (szSize == 0 || szSize > (1 << 20))
+    return 0;
+
+  std::string strElement;
+
+  // Must stay inside the input and return a whole element
+  if (FindCSAElementBytes((const char *)p_ui8Data, szSize, "B_value", strElement) && (strElement.size() > szSize || strElement.compare(0, 8, std::string("B_value", 8)) != 0))
+    __builtin_trap();
+
+  std::string strElementValue, strElementBValue;
+
+  // Whatever FindCSAElementBytes() accepts must have consistent items
+  if (strElement.size() > 0) {
+    if (!GetCSAElementString(strElement, strElementValue))
+      __builtin_trap();
+
+    NormalizeBValue(strElementValue, strElementBValue);
+  }
+
+  const int iEncodeLength = gdcm::Base64::GetEncodeLength((const char *)p_ui8Data, (int)szSize);
+
+  if (iEncodeLength <= 0)
+    return 0;
+
+  std::vector<char> vBuffer(iEncodeLength);
+
+  const size_t szEncoded = gdcm::Base64::Encode(&vBuffer[0], vBuffer.size(), (const char *)p_ui8Data, szSize);
+
+  if (szEncoded == 0)
+    return 0;
+
+  itk::MetaDataDictionary clDicomTags;
+  itk::EncapsulateMetaData<std::string>(clDicomTags, "0029|1010", std::string(vBuffer.begin(), vBuffer.begin() + szEncoded));
+
+  gdcm::CSAHeader clCSAHeader;
+
+  if (!GetCSAHeaderFromElement(clDicomTags, "0029|1010", clCSAHeader))
+    return 0;
+
+  std::string strValue, strBValue;
+
+  if (ExposeCSAMetaData(clCSAHeader, "B_value", strValue))
+    NormalizeBValue(strValue, strBValue);
+
+  ExposeCSAMetaData(clCSAHeader, "SequenceName", strValue);
+
+  int32_t i32Value = 0;
+  double dValue = 0.0;
+
+  ExposeCSAMetaData(clCSAHeader, "NumberOfImagesInMosaic", i32Value);
+  ExposeCSAMetaData(clCSAHeader, "B_value", dValue);
+
+  return 0;
+}
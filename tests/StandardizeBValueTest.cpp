@@ -0,0 +1,1154 @@
+/*-
+ * Copyright (c) 2018 Nathan Lay (enslay@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Regression tests run by CTest (see CMakeLists.txt in this folder). Every test generates its own small
+// synthetic DICOM corpus with gdcm, so no image data is checked in, then runs StandardizeBValue on a copy
+// of it. Only the expected results (Expected.csv) are kept in the source tree.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Common.h"
+
+#include "gdcmDataElement.h"
+#include "gdcmItem.h"
+#include "gdcmSequenceOfItems.h"
+#include "gdcmExplicitDataElement.h"
+#include "gdcmSwapper.h"
+#include "gdcmImageReader.h"
+#include "gdcmImageWriter.h"
+#include "gdcmImageChangeTransferSyntax.h"
+
+namespace {
+
+// Tells CTest the test was skipped (see SKIP_RETURN_CODE in CMakeLists.txt)
+const int SKIP_RETURN_CODE = 77;
+
+// What a run should report for a corpus file (one row of Expected.csv or the export table)
+struct ResultType {
+  std::string strOutcome;
+  std::string strBValue;
+  std::string strResolver;
+};
+
+void Usage(const char *p_cArg0) {
+  std::cerr << "Usage: " << p_cArg0 << " golden|readonly|list|nulllist|hardlinks|shards|journal|failures|daemon toolPath expectedFile workFolder [toolOption ...]" << std::endl;
+  std::cerr << "       " << p_cArg0 << " throughput toolPath workFolder numFiles minFilesPerSecond minRatio [toolOption ...]" << std::endl;
+  std::cerr << "       " << p_cArg0 << " startup toolPath workFolder numRuns maxMilliSeconds [toolOption ...]" << std::endl;
+  exit(1);
+}
+
+bool MakeFolders(const std::string &strPath) {
+  size_t p = 0;
+
+  do {
+    p = strPath.find('/', p + 1);
+
+    const std::string strFolder = strPath.substr(0, p);
+
+    if (!IsFolder(strFolder) && !MkDir(strFolder)) {
+      std::cerr << "Error: Could not create folder '" << strFolder << "'." << std::endl;
+      return false;
+    }
+  } while (p != std::string::npos);
+
+  return true;
+}
+
+// Little endian like the corpus' transfer syntax
+template<typename ValueType>
+void AppendBinary(std::string &strBytes, ValueType value) {
+  unsigned char a_ucBytes[sizeof(ValueType)];
+  std::memcpy(a_ucBytes, &value, sizeof(ValueType));
+
+  for (size_t i = 0; i < sizeof(ValueType); ++i)
+    strBytes += (char)a_ucBytes[i]; // Assumes a little endian host (x86, ARM)
+}
+
+void InsertElement(gdcm::DataSet &clDataSet, uint16_t ui16Group, uint16_t ui16Element, gdcm::VR::VRType eVR, std::string strValue) {
+  if (strValue.size() % 2 != 0)
+    strValue += (eVR == gdcm::VR::UI || gdcm::VR::IsBinary(eVR)) ? '\0' : ' ';
+
+  gdcm::DataElement clElement(gdcm::Tag(ui16Group, ui16Element));
+  clElement.SetVR(eVR);
+  clElement.SetByteValue(strValue.data(), (uint32_t)strValue.size());
+
+  clDataSet.Replace(clElement);
+}
+
+// Sequence with one item holding clItemDataSet
+void InsertSequence(gdcm::DataSet &clDataSet, uint16_t ui16Group, uint16_t ui16Element, const gdcm::DataSet &clItemDataSet) {
+  gdcm::Item clItem;
+  clItem.SetVLToUndefined();
+  clItem.SetNestedDataSet(clItemDataSet);
+
+  gdcm::SmartPointer<gdcm::SequenceOfItems> p_clSequence = new gdcm::SequenceOfItems();
+  p_clSequence->SetLengthToUndefined();
+  p_clSequence->AddItem(clItem);
+
+  gdcm::DataElement clElement(gdcm::Tag(ui16Group, ui16Element));
+  clElement.SetVR(gdcm::VR::SQ);
+  clElement.SetValue(*p_clSequence);
+  clElement.SetVLToUndefined();
+
+  clDataSet.Replace(clElement);
+}
+
+void InsertUS(gdcm::DataSet &clDataSet, uint16_t ui16Group, uint16_t ui16Element, uint16_t ui16Value) {
+  std::string strBytes;
+  AppendBinary(strBytes, ui16Value);
+  InsertElement(clDataSet, ui16Group, ui16Element, gdcm::VR::US, strBytes);
+}
+
+// A Siemens CSA2 ("SV10") header with one element per name/value pair (all one string item)
+std::string MakeCSAHeader(const std::vector<std::pair<std::string, std::string>> &vElements) {
+  std::string strCSA("SV10\4\3\2\1", 8);
+  AppendBinary(strCSA, (uint32_t)vElements.size());
+  AppendBinary(strCSA, (uint32_t)77);
+
+  for (const auto &clPair : vElements) {
+    char a_cName[64];
+    std::memset(a_cName, 0, sizeof(a_cName));
+    std::strncpy(a_cName, clPair.first.c_str(), sizeof(a_cName) - 1);
+
+    strCSA.append(a_cName, sizeof(a_cName));
+    AppendBinary(strCSA, (int32_t)1); // VM
+    strCSA.append("DS\0\0", 4);
+    AppendBinary(strCSA, (int32_t)3); // SyngoDT
+    AppendBinary(strCSA, (int32_t)1); // Number of items
+    AppendBinary(strCSA, (int32_t)77);
+
+    const std::string strItem = clPair.second + '\0';
+    const int32_t i32Length = (int32_t)strItem.size();
+
+    AppendBinary(strCSA, i32Length);
+    AppendBinary(strCSA, i32Length);
+    AppendBinary(strCSA, (int32_t)77);
+    AppendBinary(strCSA, i32Length);
+
+    strCSA += strItem;
+    strCSA.append((4 - strItem.size() % 4) % 4, '\0');
+  }
+
+  return strCSA;
+}
+
+// Uncompressed 8x8 MR (or CT) slice with the given identifying elements, plus whatever clExtra adds
+bool MakeDicomFile(const std::string &strPath, unsigned int uiNumber, const std::string &strModality, const std::string &strManufacturer, const std::string &strModel,
+  const std::string &strPatientName, const std::string &strSequenceName, const std::function<void(gdcm::DataSet &)> &clExtra = std::function<void(gdcm::DataSet &)>()) {
+  const std::string strRoot = "1.2.826.0.1.3680043.9.7133";
+  const std::string strSeriesUID = strRoot + ".2." + std::to_string(uiNumber);
+
+  gdcm::DataSet clDataSet;
+
+  InsertElement(clDataSet, 0x0008, 0x0016, gdcm::VR::UI, strModality == "MR" ? "1.2.840.10008.5.1.4.1.1.4" : "1.2.840.10008.5.1.4.1.1.2");
+  InsertElement(clDataSet, 0x0008, 0x0018, gdcm::VR::UI, strSeriesUID + ".1");
+  InsertElement(clDataSet, 0x0008, 0x0060, gdcm::VR::CS, strModality);
+  InsertElement(clDataSet, 0x0008, 0x0070, gdcm::VR::LO, strManufacturer);
+  InsertElement(clDataSet, 0x0008, 0x1090, gdcm::VR::LO, strModel);
+  InsertElement(clDataSet, 0x0010, 0x0010, gdcm::VR::PN, strPatientName);
+  InsertElement(clDataSet, 0x0010, 0x0020, gdcm::VR::LO, strPatientName);
+  InsertElement(clDataSet, 0x0018, 0x0024, gdcm::VR::SH, strSequenceName);
+  InsertElement(clDataSet, 0x0020, 0x000d, gdcm::VR::UI, strRoot + ".1");
+  InsertElement(clDataSet, 0x0020, 0x000e, gdcm::VR::UI, strSeriesUID);
+  InsertElement(clDataSet, 0x0020, 0x0013, gdcm::VR::IS, "1");
+  InsertUS(clDataSet, 0x0028, 0x0002, 1);
+  InsertElement(clDataSet, 0x0028, 0x0004, gdcm::VR::CS, "MONOCHROME2");
+  InsertUS(clDataSet, 0x0028, 0x0010, 8);
+  InsertUS(clDataSet, 0x0028, 0x0011, 8);
+  InsertUS(clDataSet, 0x0028, 0x0100, 16);
+  InsertUS(clDataSet, 0x0028, 0x0101, 12);
+  InsertUS(clDataSet, 0x0028, 0x0102, 11);
+  InsertUS(clDataSet, 0x0028, 0x0103, 0);
+
+  std::string strPixels;
+
+  for (unsigned int i = 0; i < 8*8; ++i)
+    AppendBinary(strPixels, (uint16_t)((i*37 + uiNumber*11) % 4096));
+
+  InsertElement(clDataSet, 0x7fe0, 0x0010, gdcm::VR::OW, strPixels);
+
+  if (clExtra)
+    clExtra(clDataSet);
+
+  gdcm::File clFile;
+  clFile.GetHeader().SetDataSetTransferSyntax(gdcm::TransferSyntax::ExplicitVRLittleEndian);
+  clFile.SetDataSet(clDataSet);
+
+  gdcm::Writer clWriter;
+  clWriter.SetFileName(strPath.c_str());
+  clWriter.SetFile(clFile);
+  clWriter.SetCheckFileMetaInformation(true);
+
+  if (!clWriter.Write()) {
+    std::cerr << "Error: Could not write '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Re-encode Pixel Data as RLE fragments (exercises the encapsulated path)
+bool CompressDicomFile(const std::string &strPath) {
+  gdcm::ImageReader clReader;
+  clReader.SetFileName(strPath.c_str());
+
+  if (!clReader.Read())
+    return false;
+
+  gdcm::ImageChangeTransferSyntax clChange;
+  clChange.SetTransferSyntax(gdcm::TransferSyntax::RLELossless);
+  clChange.SetInput(clReader.GetImage());
+
+  if (!clChange.Change())
+    return false;
+
+  gdcm::ImageWriter clWriter;
+  clWriter.SetFileName(strPath.c_str());
+  clWriter.SetFile(clReader.GetFile());
+  clWriter.SetImage(clChange.GetOutput());
+
+  return clWriter.Write();
+}
+
+// One file per vendor rule and per kind of file to skip. Names match Expected.csv.
+bool MakeCorpus(const std::string &strFolder) {
+  if (!MakeFolders(strFolder))
+    return false;
+
+  const std::string strCSA = MakeCSAHeader({ { "EchoLinePosition", "64" }, { "B_value", "50.00000000" }, { "NumberOfImagesInMosaic", "0" } });
+
+  auto AddSiemensPrivate = [](gdcm::DataSet &clDataSet) {
+    InsertElement(clDataSet, 0x0019, 0x0010, gdcm::VR::LO, "SIEMENS MR HEADER");
+    InsertElement(clDataSet, 0x0019, 0x100c, gdcm::VR::IS, "800");
+  };
+
+  auto AddSiemensCSA = [&strCSA](gdcm::DataSet &clDataSet) {
+    InsertElement(clDataSet, 0x0029, 0x0010, gdcm::VR::LO, "SIEMENS CSA HEADER");
+    InsertElement(clDataSet, 0x0029, 0x1010, gdcm::VR::OB, strCSA);
+  };
+
+  auto AddGE = [](const std::string &strSlop) {
+    return [strSlop](gdcm::DataSet &clDataSet) {
+      InsertElement(clDataSet, 0x0043, 0x0010, gdcm::VR::LO, "GEMS_PARM_01");
+      InsertElement(clDataSet, 0x0043, 0x1039, gdcm::VR::IS, strSlop);
+    };
+  };
+
+  auto AddPhilips = [](gdcm::DataSet &clDataSet) {
+    std::string strBytes;
+    AppendBinary(strBytes, 1500.0f);
+
+    InsertElement(clDataSet, 0x2001, 0x0010, gdcm::VR::LO, "Philips Imaging DD 001");
+    InsertElement(clDataSet, 0x2001, 0x1003, gdcm::VR::FL, strBytes);
+  };
+
+  auto AddStandard = [](gdcm::DataSet &clDataSet) {
+    std::string strBytes;
+    AppendBinary(strBytes, 700.0);
+
+    InsertElement(clDataSet, 0x0018, 0x9087, gdcm::VR::FD, strBytes);
+  };
+
+  // Shared Functional Groups > MR Diffusion Sequence > Diffusion b-value, as in enhanced MR files
+  auto AddFunctionalGroup = [](gdcm::DataSet &clDataSet) {
+    std::string strBytes;
+    AppendBinary(strBytes, 2500.0);
+
+    gdcm::DataSet clDiffusion;
+    InsertElement(clDiffusion, 0x0018, 0x9087, gdcm::VR::FD, strBytes);
+    InsertElement(clDiffusion, 0x0018, 0x9075, gdcm::VR::CS, "ISOTROPIC");
+
+    gdcm::DataSet clGroup;
+    InsertSequence(clGroup, 0x0018, 0x9117, clDiffusion);
+
+    InsertSequence(clDataSet, 0x5200, 0x9229, clGroup);
+  };
+
+  const std::string strPrefix = strFolder + '/';
+  bool bSuccess = true;
+
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "siemens_private.dcm", 1, "MR", "SIEMENS", "Avanto", "Synthetic^One", "*ep2d_diff", AddSiemensPrivate);
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "siemens_sequence_name.dcm", 2, "MR", "SIEMENS", "Avanto", "Synthetic^Two", "*ep_b1400t");
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "siemens_csa.dcm", 3, "MR", "SIEMENS", "Avanto", "Synthetic^Three", "*ep2d_diff", AddSiemensCSA);
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "siemens_skyra.dcm", 4, "MR", "SIEMENS", "Skyra", "Synthetic^Four", "*ep_b2000t", AddSiemensPrivate);
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "siemens_rle.dcm", 5, "MR", "SIEMENS", "Avanto", "Synthetic^Five", "*ep2d_diff", AddSiemensCSA);
+  bSuccess = bSuccess && CompressDicomFile(strPrefix + "siemens_rle.dcm");
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "prostatex.dcm", 6, "MR", "SIEMENS", "TrioTim", "ProstateX-0000", "*ep_b800t");
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "ge.dcm", 7, "MR", "GE MEDICAL SYSTEMS", "DISCOVERY MR750", "Synthetic^Seven", "", AddGE("1000\\8\\0\\0"));
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "ge_large.dcm", 8, "MR", "GE MEDICAL SYSTEMS", "DISCOVERY MR750", "Synthetic^Eight", "", AddGE("1000000600\\8\\0\\0"));
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "philips.dcm", 9, "MR", "Philips Medical Systems", "Achieva", "Synthetic^Nine", "DwiSE", AddPhilips);
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "standard.dcm", 10, "MR", "SIEMENS", "Prisma", "Synthetic^Ten", "*ep_b700t", AddStandard);
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "enhanced.dcm", 13, "MR", "Philips Medical Systems", "Ingenia", "Synthetic^Thirteen", "DwiSE", AddFunctionalGroup);
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "siemens_t2.dcm", 11, "MR", "SIEMENS", "Avanto", "Synthetic^Eleven", "*tse2d1_15");
+  bSuccess = bSuccess && MakeDicomFile(strPrefix + "ct.dcm", 12, "CT", "SIEMENS", "SOMATOM", "Synthetic^Twelve", "");
+
+  if (bSuccess) {
+    std::ofstream clStream((strPrefix + "not_dicom.txt").c_str());
+    clStream << "Not a DICOM file." << std::endl;
+    bSuccess = (bool)clStream;
+  }
+
+  if (!bSuccess)
+    std::cerr << "Error: Could not make the test corpus in '" << strFolder << "'." << std::endl;
+
+  return bSuccess;
+}
+
+bool CopyFolder(const std::string &strFrom, const std::string &strTo) {
+  if (!MakeFolders(strTo))
+    return false;
+
+  std::vector<std::string> vFiles;
+  FindFiles(strFrom.c_str(), "*", vFiles, false);
+
+  for (const std::string &strFile : vFiles) {
+    if (!Copy(strFile, strTo + '/' + BaseName(strFile), true)) {
+      std::cerr << "Error: Could not copy '" << strFile << "' to '" << strTo << "'." << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ReadFileBytes(const std::string &strPath, std::string &strBytes) {
+  std::ifstream clStream(strPath.c_str(), std::ios::in | std::ios::binary);
+
+  if (!clStream)
+    return false;
+
+  std::stringstream clBuffer;
+  clBuffer << clStream.rdbuf();
+  strBytes = clBuffer.str();
+
+  return true;
+}
+
+std::string ShellQuote(const std::string &strArg) {
+  std::string strQuoted = "'";
+
+  for (char c : strArg) {
+    if (c == '\'')
+      strQuoted += "'\\''";
+    else
+      strQuoted += c;
+  }
+
+  strQuoted += '\'';
+
+  return strQuoted;
+}
+
+// Returns the exit status (-1 if it did not exit normally). Output goes to strLogFile.
+int RunTool(const std::string &strTool, const std::vector<std::string> &vArgs, const std::string &strLogFile) {
+  std::string strCommand = ShellQuote(strTool);
+
+  for (const std::string &strArg : vArgs)
+    strCommand += ' ' + ShellQuote(strArg);
+
+  strCommand += " > " + ShellQuote(strLogFile) + " 2>&1";
+
+  const int iStatus = std::system(strCommand.c_str());
+
+  if (iStatus == -1 || !WIFEXITED(iStatus))
+    return -1;
+
+  return WEXITSTATUS(iStatus);
+}
+
+// File name -> result
+bool LoadExpected(const std::string &strPath, std::map<std::string, ResultType> &mapExpected) {
+  std::ifstream clStream(strPath.c_str());
+
+  if (!clStream) {
+    std::cerr << "Error: Could not open '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  std::string strLine;
+  while (std::getline(clStream, strLine)) {
+    Trim(strLine);
+
+    if (strLine.empty() || strLine[0] == '#')
+      continue;
+
+    const std::vector<std::string> vFields = SplitString(strLine, ",");
+
+    if (vFields.size() < 2 || vFields.size() > 4) {
+      std::cerr << "Error: Malformed line in '" << strPath << "': " << strLine << std::endl;
+      return false;
+    }
+
+    ResultType &stResult = mapExpected[vFields[0]];
+    stResult.strOutcome = vFields[1];
+    stResult.strBValue = vFields.size() > 2 ? vFields[2] : std::string();
+    stResult.strResolver = vFields.size() > 3 ? vFields[3] : std::string();
+  }
+
+  return true;
+}
+
+// File name -> result from the export table (-c). The corpus has no commas or quotes in paths.
+bool LoadExport(const std::string &strPath, std::map<std::string, ResultType> &mapResults) {
+  std::ifstream clStream(strPath.c_str());
+
+  if (!clStream) {
+    std::cerr << "Error: Could not open export file '" << strPath << "'." << std::endl;
+    return false;
+  }
+
+  // Every field is quoted (paths in the corpus never contain commas or quotes)
+  auto Unquote = [](const std::string &strField) -> std::string {
+    return strField.size() >= 2 && strField.front() == '"' && strField.back() == '"' ? strField.substr(1, strField.size() - 2) : strField;
+  };
+
+  std::string strLine;
+  std::getline(clStream, strLine); // Header
+
+  while (std::getline(clStream, strLine)) {
+    const std::vector<std::string> vFields = SplitString(strLine, ",");
+
+    if (vFields.size() < 4 || vFields[0].size() < 2) {
+      std::cerr << "Error: Malformed line in '" << strPath << "': " << strLine << std::endl;
+      return false;
+    }
+
+    const std::string strFileName = BaseName(Unquote(vFields[0]));
+
+    if (mapResults.find(strFileName) != mapResults.end()) {
+      std::cerr << "Error: '" << strFileName << "' was exported more than once." << std::endl;
+      return false;
+    }
+
+    ResultType &stResult = mapResults[strFileName];
+    stResult.strBValue = Unquote(vFields[vFields.size() - 3]);
+    stResult.strResolver = Unquote(vFields[vFields.size() - 2]);
+    stResult.strOutcome = Unquote(vFields[vFields.size() - 1]);
+  }
+
+  return true;
+}
+
+bool CheckResults(const std::map<std::string, ResultType> &mapExpected, const std::map<std::string, ResultType> &mapResults) {
+  bool bSuccess = true;
+
+  for (const auto &clPair : mapExpected) {
+    auto itr = mapResults.find(clPair.first);
+
+    if (itr == mapResults.end()) {
+      std::cerr << "Error: No result for '" << clPair.first << "'." << std::endl;
+      bSuccess = false;
+      continue;
+    }
+
+    const ResultType &stExpected = clPair.second;
+    const ResultType &stResult = itr->second;
+
+    if (stResult.strOutcome != stExpected.strOutcome || stResult.strBValue != stExpected.strBValue || stResult.strResolver != stExpected.strResolver) {
+      std::cerr << "Error: '" << clPair.first << "': expected (" << stExpected.strOutcome << ", " << stExpected.strBValue << ", " << stExpected.strResolver <<
+        ") but got (" << stResult.strOutcome << ", " << stResult.strBValue << ", " << stResult.strResolver << ")." << std::endl;
+      bSuccess = false;
+    }
+  }
+
+  if (mapResults.size() != mapExpected.size()) {
+    std::cerr << "Error: Expected " << mapExpected.size() << " results but got " << mapResults.size() << '.' << std::endl;
+    bSuccess = false;
+  }
+
+  return bSuccess;
+}
+
+std::string GetElementBytes(const gdcm::DataElement &clElement) {
+  std::ostringstream clStream;
+  clElement.Write<gdcm::ExplicitDataElement, gdcm::SwapperNoOp>(clStream);
+  return clStream.str();
+}
+
+// Everything in strNewPath (file meta information included) must be byte identical to strOldPath
+// except for an added (0018,9087) holding dBValue
+bool CheckStandardizedFile(const std::string &strOldPath, const std::string &strNewPath, double dBValue) {
+  gdcm::Reader clOldReader, clNewReader;
+  clOldReader.SetFileName(strOldPath.c_str());
+  clNewReader.SetFileName(strNewPath.c_str());
+
+  if (!clOldReader.Read() || !clNewReader.Read()) {
+    std::cerr << "Error: Could not read '" << strOldPath << "' or '" << strNewPath << "'." << std::endl;
+    return false;
+  }
+
+  const gdcm::Tag clBValueTag(0x0018, 0x9087);
+  bool bSuccess = true;
+
+  auto Compare = [&](const gdcm::DataSet &clOld, const gdcm::DataSet &clNew, bool bExpectBValue) {
+    unsigned int uiNumCompared = 0;
+
+    for (auto itr = clNew.Begin(); itr != clNew.End(); ++itr) {
+      const gdcm::DataElement &clElement = *itr;
+
+      if (bExpectBValue && clElement.GetTag() == clBValueTag)
+        continue;
+
+      if (!clOld.FindDataElement(clElement.GetTag())) {
+        std::cerr << "Error: '" << strNewPath << "' has an extra element " << clElement.GetTag() << '.' << std::endl;
+        bSuccess = false;
+        continue;
+      }
+
+      if (GetElementBytes(clElement) != GetElementBytes(clOld.GetDataElement(clElement.GetTag()))) {
+        std::cerr << "Error: Element " << clElement.GetTag() << " of '" << strNewPath << "' changed." << std::endl;
+        bSuccess = false;
+      }
+
+      ++uiNumCompared;
+    }
+
+    if (uiNumCompared != clOld.Size()) {
+      std::cerr << "Error: '" << strNewPath << "' lost elements." << std::endl;
+      bSuccess = false;
+    }
+  };
+
+  Compare(clOldReader.GetFile().GetHeader(), clNewReader.GetFile().GetHeader(), false);
+  Compare(clOldReader.GetFile().GetDataSet(), clNewReader.GetFile().GetDataSet(), true);
+
+  const gdcm::DataSet &clNewDataSet = clNewReader.GetFile().GetDataSet();
+  const gdcm::ByteValue *p_clBValue = clNewDataSet.FindDataElement(clBValueTag) ? clNewDataSet.GetDataElement(clBValueTag).GetByteValue() : nullptr;
+
+  double dStoredBValue = -1.0;
+
+  if (p_clBValue == nullptr || p_clBValue->GetLength() != sizeof(double) || !p_clBValue->GetBuffer((char *)&dStoredBValue, sizeof(double)) || dStoredBValue != dBValue) {
+    std::cerr << "Error: '" << strNewPath << "' does not have (0018,9087) = " << dBValue << '.' << std::endl;
+    bSuccess = false;
+  }
+
+  return bSuccess;
+}
+
+bool CheckSameBytes(const std::string &strOldPath, const std::string &strNewPath) {
+  std::string strOldBytes, strNewBytes;
+
+  if (!ReadFileBytes(strOldPath, strOldBytes) || !ReadFileBytes(strNewPath, strNewBytes) || strOldBytes != strNewBytes) {
+    std::cerr << "Error: '" << strNewPath << "' is not byte identical to '" << strOldPath << "'." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Standardized files gain only (0018,9087), every other file is left untouched (or, for a dry run, every file)
+bool CheckFiles(const std::map<std::string, ResultType> &mapExpected, const std::string &strOldFolder, const std::string &strNewFolder, bool bDryRun) {
+  bool bSuccess = true;
+
+  for (const auto &clPair : mapExpected) {
+    const std::string strOldPath = strOldFolder + '/' + clPair.first;
+    const std::string strNewPath = strNewFolder + '/' + clPair.first;
+
+    if (!bDryRun && clPair.second.strOutcome == "standardized")
+      bSuccess = CheckStandardizedFile(strOldPath, strNewPath, strtod(clPair.second.strBValue.c_str(), nullptr)) && bSuccess;
+    else
+      bSuccess = CheckSameBytes(strOldPath, strNewPath) && bSuccess;
+  }
+
+  // No temporary files left behind
+  std::vector<std::string> vFiles;
+  FindFiles(strNewFolder.c_str(), ".*", vFiles, false);
+
+  for (const std::string &strFile : vFiles) {
+    std::cerr << "Error: Left behind '" << strFile << "'." << std::endl;
+    bSuccess = false;
+  }
+
+  return bSuccess;
+}
+
+// How the golden test hands the corpus to the tool
+enum GoldenMode {
+  GOLDEN_FOLDER, // The folder is given on the command line
+  GOLDEN_READ_ONLY_FOLDER, // Same, but the folder is read-only (the files are not), so every file is overwritten in place
+  GOLDEN_LIST, // Every file is listed in a file given with -f
+  GOLDEN_NULL_LIST, // Same, separated by null characters (-0)
+  GOLDEN_HARD_LINKS, // Every file has a second hard link outside the folder that must see the change
+  GOLDEN_SHARDS, // Two shards (-s) whose results files are merged (-m) afterward
+  GOLDEN_JOURNAL, // With -J, so the second run skips every file
+  GOLDEN_FAILURES, // With -F, which must stay empty since no outcome in the corpus is worth retrying
+  GOLDEN_DAEMON // The files are copied into a watched folder (-d)
+};
+
+// Start the tool in the background with its output going to strLogFile
+pid_t StartTool(const std::string &strTool, const std::vector<std::string> &vArgs, const std::string &strLogFile) {
+  std::vector<char *> vArgv;
+  vArgv.push_back(const_cast<char *>(strTool.c_str()));
+
+  for (const std::string &strArg : vArgs)
+    vArgv.push_back(const_cast<char *>(strArg.c_str()));
+
+  vArgv.push_back(nullptr);
+
+  const pid_t pid = fork();
+
+  if (pid == 0) {
+    const int iFd = open(strLogFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (iFd != -1) {
+      dup2(iFd, STDOUT_FILENO);
+      dup2(iFd, STDERR_FILENO);
+      close(iFd);
+    }
+
+    execv(strTool.c_str(), &vArgv[0]);
+    _exit(127);
+  }
+
+  return pid;
+}
+
+size_t CountLines(const std::string &strPath) {
+  std::string strBytes;
+
+  if (!ReadFileBytes(strPath, strBytes))
+    return 0;
+
+  return (size_t)std::count(strBytes.begin(), strBytes.end(), '\n');
+}
+
+// Copy the files to a folder the tool is watching, wait until all of them have been exported (the daemon flushes the
+// export every few seconds) and stop it
+int RunDaemonTool(const std::string &strTool, const std::vector<std::string> &vArgs, const std::string &strLogFile, const std::string &strFromFolder,
+  const std::string &strToFolder, const std::string &strExportFile, size_t szNumFiles) {
+  const pid_t pid = StartTool(strTool, vArgs, strLogFile);
+
+  if (pid == -1) {
+    std::cerr << "Error: Could not start '" << strTool << "': " << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  const auto clDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  bool bWatching = false;
+  bool bDone = false;
+
+  while (!bWatching && std::chrono::steady_clock::now() < clDeadline) {
+    std::string strLog;
+    bWatching = ReadFileBytes(strLogFile, strLog) && strLog.find("Info: Watching") != std::string::npos;
+
+    if (!bWatching)
+      USleep(100000);
+  }
+
+  if (bWatching && CopyFolder(strFromFolder, strToFolder)) {
+    while (!bDone && std::chrono::steady_clock::now() < clDeadline) {
+      bDone = CountLines(strExportFile) >= szNumFiles + 1; // Header included
+
+      if (!bDone)
+        USleep(100000);
+    }
+  }
+
+  kill(pid, SIGTERM);
+
+  int iStatus = 0;
+
+  if (waitpid(pid, &iStatus, 0) != pid || !WIFEXITED(iStatus))
+    return -1;
+
+  if (!bDone) {
+    std::cerr << "Error: Timed out waiting for the daemon to standardize the files." << std::endl;
+    return -1;
+  }
+
+  return WEXITSTATUS(iStatus);
+}
+
+// Standardize a fresh copy of the corpus with the given options and the given way of handing it to the tool, compare
+// with the expected results and the original files, then run again to check that nothing more changes
+int RunGoldenTest(const std::string &strTool, const std::string &strExpectedFile, const std::string &strWorkFolder, const std::vector<std::string> &vToolOptions, GoldenMode eMode) {
+  std::map<std::string, ResultType> mapExpected;
+
+  if (!LoadExpected(strExpectedFile, mapExpected))
+    return 1;
+
+  const std::string strCorpusFolder = strWorkFolder + "/Corpus";
+  const std::string strRunFolder = strWorkFolder + "/Run";
+  const std::string strFirstFolder = strWorkFolder + "/First";
+  const std::string strLinksFolder = strWorkFolder + "/Links";
+  const std::string strExportFile = strWorkFolder + "/export.csv";
+  const std::string strListFile = strWorkFolder + "/list.txt";
+  const std::string strResultsFile = strWorkFolder + "/results.txt";
+  const std::string strMergedFile = strWorkFolder + "/merged.txt";
+  const std::string strJournalFile = strWorkFolder + "/journal.txt";
+  const std::string strFailuresFile = strWorkFolder + "/failures.txt";
+
+  // Writable again in case an earlier run stopped early
+  chmod(strRunFolder.c_str(), 0755);
+
+  if (!MakeCorpus(strCorpusFolder))
+    return 1;
+
+  // The tool appends to these
+  Unlink(strJournalFile);
+  Unlink(strResultsFile + ".0");
+  Unlink(strResultsFile + ".1");
+  Unlink(strMergedFile);
+
+  if (eMode == GOLDEN_DAEMON) {
+    // Only files arriving after it starts are standardized
+    std::vector<std::string> vFiles;
+    FindFiles(strRunFolder.c_str(), "*", vFiles, false);
+
+    for (const std::string &strFile : vFiles)
+      Unlink(strFile);
+
+    if (!MakeFolders(strRunFolder))
+      return 1;
+  }
+  else if (!CopyFolder(strCorpusFolder, strRunFolder))
+    return 1;
+
+  if (eMode == GOLDEN_READ_ONLY_FOLDER && chmod(strRunFolder.c_str(), 0555) != 0) {
+    std::cerr << "Error: Could not make '" << strRunFolder << "' read-only: " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  // So the build tree can still be removed
+  struct RestoreMode {
+    std::string strPath;
+    ~RestoreMode() { chmod(strPath.c_str(), 0755); }
+  } clRestore = { strRunFolder };
+
+  if (eMode == GOLDEN_HARD_LINKS) {
+    if (!MakeFolders(strLinksFolder))
+      return 1;
+
+    for (const auto &clPair : mapExpected) {
+      const std::string strLink = strLinksFolder + '/' + clPair.first;
+
+      Unlink(strLink);
+
+      if (link((strRunFolder + '/' + clPair.first).c_str(), strLink.c_str()) != 0) {
+        std::cerr << "Error: Could not link '" << strLink << "': " << strerror(errno) << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (eMode == GOLDEN_LIST || eMode == GOLDEN_NULL_LIST) {
+    const char cDelimiter = (eMode == GOLDEN_NULL_LIST) ? '\0' : '\n';
+
+    std::ofstream clStream(strListFile.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+
+    for (const auto &clPair : mapExpected)
+      clStream << strRunFolder << '/' << clPair.first << cDelimiter;
+
+    if (!clStream) {
+      std::cerr << "Error: Could not write '" << strListFile << "'." << std::endl;
+      return 1;
+    }
+  }
+
+  const bool bDryRun = std::find(vToolOptions.begin(), vToolOptions.end(), "-n") != vToolOptions.end();
+
+  std::vector<std::string> vArgs = vToolOptions;
+  vArgs.push_back("-c");
+  vArgs.push_back(strExportFile);
+
+  switch (eMode) {
+  case GOLDEN_NULL_LIST:
+    vArgs.push_back("-0");
+    // Fall through
+  case GOLDEN_LIST:
+    vArgs.push_back("-f");
+    vArgs.push_back(strListFile);
+    break;
+  case GOLDEN_FAILURES:
+    vArgs.push_back("-F");
+    vArgs.push_back(strFailuresFile);
+    vArgs.push_back(strRunFolder);
+    break;
+  case GOLDEN_SHARDS:
+    vArgs.push_back("-o");
+    vArgs.push_back(strResultsFile);
+    vArgs.push_back(strRunFolder);
+    break;
+  case GOLDEN_JOURNAL:
+    vArgs.push_back("-J");
+    vArgs.push_back(strJournalFile);
+    vArgs.push_back(strRunFolder);
+    break;
+  case GOLDEN_DAEMON:
+    vArgs.push_back("-d");
+    vArgs.push_back(strRunFolder);
+    break;
+  default:
+    vArgs.push_back(strRunFolder);
+    break;
+  }
+
+  // One run (one per shard), with the files to standardize copied from strFromFolder when watching
+  auto RunPass = [&](const std::string &strName, const std::string &strFromFolder) -> bool {
+    Unlink(strExportFile);
+    Unlink(strExportFile + ".0");
+    Unlink(strExportFile + ".1");
+    Unlink(strFailuresFile);
+
+    const std::vector<std::string> vShards = (eMode == GOLDEN_SHARDS) ? std::vector<std::string>{ "0/2", "1/2" } : std::vector<std::string>{ std::string() };
+
+    for (size_t i = 0; i < vShards.size(); ++i) {
+      std::vector<std::string> vPassArgs = vArgs;
+
+      if (!vShards[i].empty()) {
+        vPassArgs.insert(vPassArgs.begin(), vShards[i]);
+        vPassArgs.insert(vPassArgs.begin(), "-s");
+      }
+
+      const std::string strLogFile = strWorkFolder + '/' + strName + (vShards.size() > 1 ? "." + std::to_string(i) : std::string()) + ".log";
+
+      const int iStatus = (eMode == GOLDEN_DAEMON) ? RunDaemonTool(strTool, vPassArgs, strLogFile, strFromFolder, strRunFolder, strExportFile, mapExpected.size()) :
+        RunTool(strTool, vPassArgs, strLogFile);
+
+      if (iStatus != 0) {
+        std::cerr << "Error: StandardizeBValue exited with status " << iStatus << " (see '" << strLogFile << "')." << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  };
+
+  // The export (of every shard)
+  auto LoadPass = [&](std::map<std::string, ResultType> &mapResults) -> bool {
+    mapResults.clear();
+
+    if (eMode == GOLDEN_SHARDS) {
+      if (!LoadExport(strExportFile + ".0", mapResults) || !LoadExport(strExportFile + ".1", mapResults))
+        return false;
+    }
+    else if (!LoadExport(strExportFile, mapResults))
+      return false;
+
+    if (eMode == GOLDEN_FAILURES) {
+      std::string strFailures;
+
+      if (!ReadFileBytes(strFailuresFile, strFailures) || !strFailures.empty()) {
+        std::cerr << "Error: '" << strFailuresFile << "' is missing or lists files that did not fail." << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  };
+
+  if (!RunPass("first", strCorpusFolder))
+    return 1;
+
+  std::map<std::string, ResultType> mapResults;
+
+  if (!LoadPass(mapResults) || !CheckResults(mapExpected, mapResults) || !CheckFiles(mapExpected, strCorpusFolder, strRunFolder, bDryRun))
+    return 1;
+
+  if (eMode == GOLDEN_HARD_LINKS) {
+    bool bSuccess = true;
+
+    for (const auto &clPair : mapExpected)
+      bSuccess = CheckSameBytes(strRunFolder + '/' + clPair.first, strLinksFolder + '/' + clPair.first) && bSuccess;
+
+    if (!bSuccess)
+      return 1;
+  }
+
+  if (eMode == GOLDEN_SHARDS) {
+    std::vector<std::string> vMergeArgs = { "-m", "-o", strMergedFile, strResultsFile + ".0", strResultsFile + ".1" };
+
+    if (RunTool(strTool, vMergeArgs, strWorkFolder + "/merge.log") != 0 || CountLines(strMergedFile) != mapExpected.size()) {
+      std::cerr << "Error: '" << strMergedFile << "' should have one line per file (see '" << strWorkFolder << "/merge.log')." << std::endl;
+      return 1;
+    }
+  }
+
+  if (bDryRun)
+    return 0;
+
+  // A second run only finds finished files and changes nothing
+  if (!CopyFolder(strRunFolder, strFirstFolder))
+    return 1;
+
+  if (!RunPass("second", strFirstFolder))
+    return 1;
+
+  for (auto &clPair : mapExpected) {
+    if (clPair.second.strOutcome == "standardized") {
+      clPair.second.strOutcome = "already_standardized";
+      clPair.second.strResolver = "standard";
+    }
+  }
+
+  if (!LoadPass(mapResults))
+    return 1;
+
+  // Everything was journaled, so nothing is even looked at
+  if (eMode == GOLDEN_JOURNAL) {
+    if (!mapResults.empty()) {
+      std::cerr << "Error: " << mapResults.size() << " journaled files were processed again." << std::endl;
+      return 1;
+    }
+
+    return CheckFiles(mapExpected, strFirstFolder, strRunFolder, true) ? 0 : 1;
+  }
+
+  if (!CheckResults(mapExpected, mapResults) || !CheckFiles(mapExpected, strFirstFolder, strRunFolder, true))
+    return 1;
+
+  return 0;
+}
+
+// Standardize many copies of a Siemens CSA file and fail when files per second fall below the absolute minimum, or below
+// dMinRatio of the rate at which this process itself reads and durably rewrites the same files with gdcm (one at a time)
+int RunThroughputTest(const std::string &strTool, const std::string &strWorkFolder, unsigned int uiNumFiles, double dMinFilesPerSecond, double dMinRatio, const std::vector<std::string> &vToolOptions) {
+  const std::string strCorpusFolder = strWorkFolder + "/Corpus";
+  const std::string strRunFolder = strWorkFolder + "/Run";
+  const std::string strReferenceFolder = strWorkFolder + "/Reference";
+
+  if (!MakeCorpus(strCorpusFolder) || !MakeFolders(strRunFolder) || !MakeFolders(strReferenceFolder))
+    return 1;
+
+  for (unsigned int i = 0; i < uiNumFiles; ++i) {
+    const std::string strFileName = "/file" + std::to_string(i) + ".dcm";
+
+    if (!Copy(strCorpusFolder + "/siemens_csa.dcm", strRunFolder + strFileName, true) || !Copy(strCorpusFolder + "/siemens_csa.dcm", strReferenceFolder + strFileName, true)) {
+      std::cerr << "Error: Could not copy test files to '" << strWorkFolder << "'." << std::endl;
+      return 1;
+    }
+  }
+
+  // Measured in the same invocation, so it scales with the machine and its load
+  auto clBegin = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < uiNumFiles; ++i) {
+    const std::string strPath = strReferenceFolder + "/file" + std::to_string(i) + ".dcm";
+
+    gdcm::Reader clReader;
+    clReader.SetFileName(strPath.c_str());
+
+    if (!clReader.Read() || !WriteDicomFile(clReader.GetFile(), strPath)) {
+      std::cerr << "Error: Could not rewrite '" << strPath << "'." << std::endl;
+      return 1;
+    }
+  }
+
+  const double dReferenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clBegin).count();
+  const double dReferenceFilesPerSecond = uiNumFiles/std::max(dReferenceSeconds, 1e-3);
+
+  std::cout << "Info: Reference rewrote " << uiNumFiles << " files in " << dReferenceSeconds << " s (" << dReferenceFilesPerSecond << " files/s)." << std::endl;
+
+  std::vector<std::string> vArgs = vToolOptions;
+  vArgs.push_back(strRunFolder);
+
+  clBegin = std::chrono::steady_clock::now();
+
+  const int iStatus = RunTool(strTool, vArgs, strWorkFolder + "/throughput.log");
+
+  const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clBegin).count();
+
+  if (iStatus != 0) {
+    std::cerr << "Error: StandardizeBValue exited with status " << iStatus << " (see '" << strWorkFolder << "/throughput.log')." << std::endl;
+    return 1;
+  }
+
+  const double dFilesPerSecond = uiNumFiles/std::max(dSeconds, 1e-3);
+
+  std::cout << "Info: " << uiNumFiles << " files in " << dSeconds << " s (" << dFilesPerSecond << " files/s, " << dFilesPerSecond/dReferenceFilesPerSecond << " of the reference)." << std::endl;
+
+  bool bSuccess = true;
+
+  if (dFilesPerSecond < dMinFilesPerSecond) {
+    std::cerr << "Error: Throughput is below the minimum of " << dMinFilesPerSecond << " files/s." << std::endl;
+    bSuccess = false;
+  }
+
+  if (dFilesPerSecond < dMinRatio*dReferenceFilesPerSecond) {
+    std::cerr << "Error: Throughput is below " << dMinRatio << " of the reference." << std::endl;
+    bSuccess = false;
+  }
+
+  return bSuccess ? 0 : 1;
+}
+
+// Launch the tool numRuns times on one file and fail when the median "Time to first file" is above uiMaxMilliSeconds
+int RunStartupTest(const std::string &strTool, const std::string &strWorkFolder, unsigned int uiNumRuns, unsigned int uiMaxMilliSeconds, const std::vector<std::string> &vToolOptions) {
+  const std::string strCorpusFolder = strWorkFolder + "/Corpus";
+  const std::string strLogFile = strWorkFolder + "/startup.log";
+
+  if (!MakeCorpus(strCorpusFolder))
+    return 1;
+
+  std::vector<std::string> vArgs = vToolOptions;
+  vArgs.push_back(strCorpusFolder + "/standard.dcm"); // Untouched, so every run does the same
+
+  std::vector<unsigned int> vMilliSeconds;
+
+  for (unsigned int i = 0; i < uiNumRuns; ++i) {
+    const int iStatus = RunTool(strTool, vArgs, strLogFile);
+
+    if (iStatus != 0) {
+      std::cerr << "Error: StandardizeBValue exited with status " << iStatus << " (see '" << strLogFile << "')." << std::endl;
+      return 1;
+    }
+
+    std::ifstream clStream(strLogFile.c_str());
+    std::string strLine;
+
+    const std::string strPrefix = "Info: Time to first file = ";
+
+    while (std::getline(clStream, strLine) && strLine.compare(0, strPrefix.size(), strPrefix) != 0) { }
+
+    if (!clStream) {
+      std::cerr << "Error: No time to first file in '" << strLogFile << "'." << std::endl;
+      return 1;
+    }
+
+    vMilliSeconds.push_back((unsigned int)strtoul(strLine.c_str() + strPrefix.size(), nullptr, 10));
+  }
+
+  std::sort(vMilliSeconds.begin(), vMilliSeconds.end());
+
+  const unsigned int uiMedian = vMilliSeconds[vMilliSeconds.size()/2];
+
+  std::cout << "Info: Time to first file = " << uiMedian << " ms (median of " << uiNumRuns << " runs, " << vMilliSeconds.front() << " to " << vMilliSeconds.back() << " ms)." << std::endl;
+
+  if (uiMedian > uiMaxMilliSeconds) {
+    std::cerr << "Error: Startup takes longer than " << uiMaxMilliSeconds << " ms." << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  const char * const p_cArg0 = argv[0];
+
+  if (argc < 2)
+    Usage(p_cArg0);
+
+  const std::string strTest = argv[1];
+
+  static const struct {
+    const char *p_cName;
+    GoldenMode eMode;
+  } a_stGoldenModes[] = {
+    { "golden", GOLDEN_FOLDER },
+    { "readonly", GOLDEN_READ_ONLY_FOLDER },
+    { "list", GOLDEN_LIST },
+    { "nulllist", GOLDEN_NULL_LIST },
+    { "hardlinks", GOLDEN_HARD_LINKS },
+    { "shards", GOLDEN_SHARDS },
+    { "journal", GOLDEN_JOURNAL },
+    { "failures", GOLDEN_FAILURES },
+    { "daemon", GOLDEN_DAEMON }
+  };
+
+  for (const auto &stGoldenMode : a_stGoldenModes) {
+    if (strTest != stGoldenMode.p_cName)
+      continue;
+
+    if (argc < 5)
+      Usage(p_cArg0);
+
+    // Permissions do not apply to root
+    if (stGoldenMode.eMode == GOLDEN_READ_ONLY_FOLDER && geteuid() == 0) {
+      std::cout << "Info: Skipping since running as root." << std::endl;
+      return SKIP_RETURN_CODE;
+    }
+
+#ifndef __linux__
+    if (stGoldenMode.eMode == GOLDEN_DAEMON) {
+      std::cout << "Info: Skipping since watching folders needs Linux." << std::endl;
+      return SKIP_RETURN_CODE;
+    }
+#endif // !__linux__
+
+    return RunGoldenTest(argv[2], argv[3], argv[4], std::vector<std::string>(argv + 5, argv + argc), stGoldenMode.eMode);
+  }
+
+  if (strTest == "throughput") {
+    if (argc < 7)
+      Usage(p_cArg0);
+
+    char *p = nullptr;
+    const unsigned long ulNumFiles = strtoul(argv[4], &p, 10);
+
+    if (*p != '\0' || ulNumFiles == 0)
+      Usage(p_cArg0);
+
+    const double dMinFilesPerSecond = strtod(argv[5], &p);
+
+    if (*p != '\0' || dMinFilesPerSecond < 0.0)
+      Usage(p_cArg0);
+
+    const double dMinRatio = strtod(argv[6], &p);
+
+    if (*p != '\0' || dMinRatio < 0.0)
+      Usage(p_cArg0);
+
+    return RunThroughputTest(argv[2], argv[3], (unsigned int)ulNumFiles, dMinFilesPerSecond, dMinRatio, std::vector<std::string>(argv + 7, argv + argc));
+  }
+
+  if (strTest == "startup") {
+    if (argc < 6)
+      Usage(p_cArg0);
+
+    char *p = nullptr;
+    const unsigned long ulNumRuns = strtoul(argv[4], &p, 10);
+
+    if (*p != '\0' || ulNumRuns == 0)
+      Usage(p_cArg0);
+
+    const unsigned long ulMaxMilliSeconds = strtoul(argv[5], &p, 10);
+
+    if (*p != '\0')
+      Usage(p_cArg0);
+
+    return RunStartupTest(argv[2], argv[3], (unsigned int)ulNumRuns, (unsigned int)ulMaxMilliSeconds, std::vector<std::string>(argv + 6, argv + argc));
+  }
+
+  Usage(p_cArg0);
+
+  return 1; // Not reached
+}